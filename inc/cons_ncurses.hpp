@@ -29,10 +29,12 @@
  ******************************************************************************/
 
 #include <ncurses.h>
+#include <sys/types.h>
 #include <string>
 #include <fstream>
 
 #include <list>
+#include <vector>
 
 #define COLOR_RSSI_LOW 1
 #define COLOR_RSSI_MED 2
@@ -61,8 +63,12 @@
 
 #define DATE_TIME_FORMAT "%m/%d/%Y %H:%M:%S"
 
-#define STATUS_INFO_KEYS "Use arrow keys to scroll. Toggle recording with R. Esc to quit."
-#define STATUS_INFO_HISTORY "Use arrow keys to scroll. Save snapshot with S. Esc to exit."
+#define STATUS_INFO_KEYS "Use arrow keys to scroll. Toggle recording with R. Sort with O. Esc to quit."
+#define STATUS_INFO_HISTORY "Use arrow keys to scroll. Follow with F. Save snapshot with S. Esc to exit."
+#define STATUS_INFO_RECEIVERS "Use arrow keys to scroll. Dump to a file with D. Esc to exit."
+
+/* Frames per second drawn for new samples unless another rate is given */
+#define FRAME_RATE 20
 
 #define RECORD_FILE_FORMAT "%Y%m%d_%H%M%S.csv"
 
@@ -100,8 +106,18 @@ typedef struct {
 void repaint();
 void resizePanels();
 void setStatus(std::string);
-void printStatusLine(WINDOW*,pip_sample_t , bool);
+void printStatusLine(WINDOW*, int, bool);
 void updateState(pip_sample_t&);
+void updateStates(pip_sample_t*, size_t);
+void setFrameRate(int);
+int frameWait();
+void renderFrame();
+void setTagAging(double, bool, size_t);
+void loadConsoleState(const std::string&);
+bool saveConsoleState(const std::string&);
+void startConsoleCheckpoint(const std::string&);
+bool finishConsoleWrites(bool);
+void ageConsole();
 void updateStatusLine(WINDOW*, int);
 void updateStatusList(WINDOW*);
 bool updateWindowBounds();
@@ -113,12 +129,12 @@ void stopNCurses();
 void ncursesUserInput();
 void initPipData(pip_sample_t&);
 void toggleRecording(int);
-void renderUpdate(int,bool);
 int getMinRow(WINDOW* win);
 int getMaxRow(WINDOW* win);
 void recordSample(pip_sample_t&);
 void recordSample(pip_sample_t&,std::ofstream&);
-void saveHistory(std::list<pip_sample_t>&);
+void saveHistory();
+bool followHistory();
 void setDisp(bool);
 void setDispOff();
 
@@ -128,5 +144,14 @@ void screenSaver(pip_sample_t&);
 
 void deleteSensor(int);
 
+void showReceivers();
+void hideReceivers();
+void refreshReceivers();
+
+// Provided by the acquisition side
+std::string usbSummary();
+std::string receiverReport();
+std::string saveReceiverReport();
+
 
 #endif
@@ -0,0 +1,83 @@
+#ifndef PIP_AGING_H_
+#define PIP_AGING_H_
+/*
+ * Copyright (C) 2014 Robert S. Moore II and Rutgers University
+ * All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA
+ * or visit http://www.gnu.org/licenses/gpl-2.0.html
+ */
+
+/*******************************************************************************
+ * @file pip_aging.hpp
+ * Bookkeeping for expiring silent tags and for dropping the history of the
+ * least recently heard tags once history outgrows its memory cap.
+ *
+ * Tags are kept in a tag order by the time they expire, their last packet
+ * plus expirePeriods of their estimated broadcast period, so the next tag
+ * to expire is always the first in that order.  They are also kept in a
+ * list from least to most recently heard.  Both are updated as each sample
+ * arrives, so neither needs a scan of all tags.  Time is the host time of
+ * the newest sample rather than the clock, so that replays age tags the
+ * way they aged when recorded.  While no samples arrive at all, time is
+ * advanced by the clock instead, so that silent tags still expire.
+ *
+ * @author Robert S. Moore II
+ ******************************************************************************/
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <vector>
+
+#include <pip_tags.hpp>
+
+/* Most tags expired or stripped of their history per batch of samples */
+#define AGING_BUDGET 64
+/* History memory cap (MB) unless one is given */
+#define AGING_DEFAULT_MEMORY 512
+
+typedef struct {
+  // Tags silent for this many of their periods expire, 0 keeps them
+  double expirePeriods;
+  // Save the history of a tag to a snapshot file before it expires
+  bool saveExpired;
+  // Bytes of history kept for all tags together, 0 for no limit
+  size_t memoryCap;
+  tag_order_t byDeadline;
+  // Tags with history from least to most recently heard, linked by slot
+  // through a circular list headed by slot 0.  -1 marks unlisted slots.
+  std::vector<int> newer;
+  std::vector<int> older;
+  // Host time (ms) of the newest sample
+  int64_t now;
+  // now and the monotonic clock (ms) at the last tick, 0 before the first
+  int64_t tickNow;
+  int64_t tickClock;
+  unsigned long expired;
+  unsigned long evicted;
+} tag_aging_t;
+
+void initAging(tag_aging_t&, double, bool, size_t);
+void agingSchedule(tag_aging_t&, const tag_table_t&, int);
+void agingBeforeUpdate(tag_aging_t&, const tag_table_t&, int);
+void agingAfterUpdate(tag_aging_t&, const tag_table_t&, int);
+void agingForget(tag_aging_t&, const tag_table_t&, int);
+void agingUnlist(tag_aging_t&, int);
+void agingTick(tag_aging_t&, int64_t);
+int expiredTag(const tag_aging_t&, int);
+int leastRecentTag(const tag_aging_t&, int);
+
+#endif
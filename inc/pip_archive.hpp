@@ -0,0 +1,134 @@
+#ifndef PIP_ARCHIVE_H_
+#define PIP_ARCHIVE_H_
+/*
+ * Copyright (C) 2014 Robert S. Moore II and Rutgers University
+ * All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA
+ * or visit http://www.gnu.org/licenses/gpl-2.0.html
+ */
+
+/*******************************************************************************
+ * @file pip_archive.hpp
+ * Compressed long-term history of every tag.
+ *
+ * Samples are stored by column in blocks of ARCHIVE_BLOCK samples.  Every
+ * column holds zigzag varints: timestamps (ms) as the change in the
+ * interval between packets, RSSI in half dB, temperature and humidity in
+ * the 16ths the tags send them in, and light, moisture and battery as they
+ * are, each as the difference from the sample before.  A presence column,
+ * run-length encoded, says which sensor values a sample has, and absent
+ * values take no space in their column.  All of these values are exact for
+ * packets decoded from a PIP.  The receiver timestamp, dropped count and
+ * microseconds are not kept.
+ *
+ * A block is encoded as its samples arrive and is compressed into one
+ * buffer when it fills.  A value that did not change is a single zero byte,
+ * and zero bytes appear nowhere else, so each column is compressed by
+ * writing runs of zero bytes as a zero and the run's length less one.  A
+ * column that this would not make smaller is kept as it is.  Blocks are
+ * only decoded when a sample in them is asked for.  Each block starts its
+ * deltas afresh, so any block can be decoded on its own.  Archives are
+ * indexed by the tag's slot in the tag table.
+ *
+ * @author Robert S. Moore II
+ ******************************************************************************/
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <vector>
+
+#include <cons_ncurses.hpp>
+
+/* Samples in a full block */
+#define ARCHIVE_BLOCK 256
+
+/* Columns of a block */
+#define ARCHIVE_TIME 0
+#define ARCHIVE_PRESENT 1
+#define ARCHIVE_RSSI 2
+#define ARCHIVE_TEMP 3
+#define ARCHIVE_RH 4
+#define ARCHIVE_LIGHT 5
+#define ARCHIVE_MOISTURE 6
+#define ARCHIVE_BATTERY_MV 7
+#define ARCHIVE_BATTERY_J 8
+#define ARCHIVE_COLUMNS 9
+
+/* First byte of a sealed column that is not empty, saying how it is stored */
+#define ARCHIVE_RAW 0
+#define ARCHIVE_ZERO_RUNS 1
+
+/* Bits of the presence column */
+#define ARCHIVE_HAS_TEMP 0x01
+#define ARCHIVE_HAS_RH 0x02
+#define ARCHIVE_HAS_LIGHT 0x04
+#define ARCHIVE_HAS_MOISTURE 0x08
+#define ARCHIVE_HAS_BATTERY_MV 0x10
+#define ARCHIVE_HAS_BATTERY_J 0x20
+
+/*
+ * Values the next sample of a block is encoded against.
+ */
+typedef struct {
+  int64_t time;
+  int64_t interval;
+  int64_t value[ARCHIVE_COLUMNS];
+} archive_state_t;
+
+typedef struct {
+  // Host time (ms) of the first sample
+  int64_t firstTime;
+  // Compressed column c ends at end[c], and starts where column c-1 ends
+  uint16_t end[ARCHIVE_COLUMNS];
+  std::vector<unsigned char> data;
+} archive_block_t;
+
+typedef struct {
+  int tagID;
+  std::vector<archive_block_t> sealed;
+  // Columns of the block being filled
+  std::vector<unsigned char> open[ARCHIVE_COLUMNS];
+  int64_t openFirst;
+  int openCount;
+  archive_state_t state;
+  // Run of presence bits not yet written to the presence column
+  unsigned char runBits;
+  int runLength;
+} archive_tag_t;
+
+typedef struct {
+  std::vector<archive_tag_t> tags;
+  // Samples archived and bytes they take, for all tags
+  size_t samples;
+  size_t bytes;
+  // Block decoded last, identified by slot, block and samples in it
+  int cacheSlot;
+  size_t cacheBlock;
+  int cacheCount;
+  std::vector<pip_sample_t> cache;
+  // Columns of the decoded block that had to be expanded
+  std::vector<unsigned char> unpacked[ARCHIVE_COLUMNS];
+} archive_t;
+
+void archiveSample(archive_t&, int, const pip_sample_t&);
+void clearArchive(archive_t&, int);
+size_t archiveCount(const archive_t&, int);
+const pip_sample_t& archivedSample(archive_t&, int, size_t);
+bool validArchive(archive_t&, int);
+double archiveBytesPerSample(const archive_t&);
+
+#endif
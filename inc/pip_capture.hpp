@@ -0,0 +1,85 @@
+#ifndef PIP_CAPTURE_H_
+#define PIP_CAPTURE_H_
+/*
+ * Copyright (C) 2014 Robert S. Moore II and Rutgers University
+ * All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA
+ * or visit http://www.gnu.org/licenses/gpl-2.0.html
+ */
+
+/*******************************************************************************
+ * @file pip_capture.hpp
+ * Append-only binary capture of the raw frames read from PIP receivers.
+ *
+ * A capture file is a capture_header_t followed by fixed-size
+ * capture_record_t records, all little endian as written by the host.
+ *
+ * @author Robert S. Moore II
+ ******************************************************************************/
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <string>
+
+#define CAPTURE_MAGIC "PIPCAP\r\n"
+#define CAPTURE_VERSION 1
+
+/* Room for the extra data length byte and the largest frame from a PIP */
+#define CAPTURE_FRAME_SIZE 36
+
+/* Bytes buffered before the capture is written out */
+#define CAPTURE_BUFFER_SIZE (1024 * 1024)
+
+typedef struct {
+  char magic[8];
+  uint32_t version;
+  // sizeof(capture_record_t) when the file was written
+  uint32_t recordSize;
+} __attribute__((packed)) capture_header_t;
+
+typedef struct {
+  // Host time the frame was read, microseconds since 1970
+  uint64_t hostTime;
+  // USB device number (bus and address) of the receiver
+  uint16_t receiver;
+  // Bytes received from the PIP, frame holds one more (the length byte)
+  uint8_t length;
+  uint8_t reserved;
+  // Raw frame as handed to decodeFrame
+  unsigned char frame[CAPTURE_FRAME_SIZE];
+} __attribute__((packed)) capture_record_t;
+
+/*
+ * A capture file mapped into memory for reading.
+ */
+typedef struct {
+  void* base;
+  size_t size;
+  const capture_record_t* records;
+  size_t count;
+} capture_map_t;
+
+bool openCapture(const std::string&);
+void captureFrame(const capture_record_t&);
+bool flushCapture();
+bool closeCapture();
+
+bool isCaptureFile(const std::string&);
+bool mapCapture(const std::string&, capture_map_t&);
+void unmapCapture(capture_map_t&);
+
+#endif
@@ -0,0 +1,73 @@
+#ifndef PIP_HISTORY_H_
+#define PIP_HISTORY_H_
+/*
+ * Copyright (C) 2014 Robert S. Moore II and Rutgers University
+ * All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA
+ * or visit http://www.gnu.org/licenses/gpl-2.0.html
+ */
+
+/*******************************************************************************
+ * @file pip_history.hpp
+ * Recent packet history of every tag, kept in ring buffers carved from one
+ * arena of samples.
+ *
+ * The arena is divided into blocks of HISTORY_BLOCK samples.  A tag's ring
+ * takes blocks from the arena as its history grows, up to HISTORY_BLOCKS of
+ * them, and from then on overwrites its oldest sample.  Blocks go back to
+ * the arena when the tag is deleted, so packets never allocate once the
+ * arena has grown to the number of tags heard.  Rings are indexed by the
+ * tag's slot in the tag table.
+ *
+ * @author Robert S. Moore II
+ ******************************************************************************/
+
+#include <vector>
+
+#include <cons_ncurses.hpp>
+
+/* Samples in one arena block and blocks in a full ring */
+#define HISTORY_BLOCK 50
+#define HISTORY_BLOCKS 20
+/* Maximum number of history packets per tag */
+#define HISTORY_DEPTH (HISTORY_BLOCK * HISTORY_BLOCKS)
+
+typedef struct {
+  // Arena blocks of the ring, in ring order
+  int blocks[HISTORY_BLOCKS];
+  int numBlocks;
+  // Position of the oldest sample, only moves once the ring is full
+  int start;
+  int count;
+  // Samples ever appended, numbering them for views of the history
+  unsigned long total;
+} history_ring_t;
+
+typedef struct {
+  std::vector<pip_sample_t> samples;
+  std::vector<int> freeBlocks;
+  // Ring of each tag table slot
+  std::vector<history_ring_t> rings;
+} history_arena_t;
+
+void appendHistory(history_arena_t&, int, const pip_sample_t&);
+void clearHistory(history_arena_t&, int);
+int historyCount(const history_arena_t&, int);
+unsigned long historyTotal(const history_arena_t&, int);
+const pip_sample_t& historySample(const history_arena_t&, int, int);
+size_t historyBytes(const history_arena_t&);
+
+#endif
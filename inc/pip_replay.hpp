@@ -0,0 +1,67 @@
+#ifndef PIP_REPLAY_H_
+#define PIP_REPLAY_H_
+/*
+ * Copyright (C) 2014 Robert S. Moore II and Rutgers University
+ * All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA
+ * or visit http://www.gnu.org/licenses/gpl-2.0.html
+ */
+
+/*******************************************************************************
+ * @file pip_replay.hpp
+ * Replays recorded samples or raw captures into the console in place of live
+ * receivers.
+ *
+ * @author Robert S. Moore II
+ ******************************************************************************/
+
+#include <atomic>
+#include <string>
+#include <thread>
+
+#include <cons_ncurses.hpp>
+#include <pip_usb.hpp>
+
+/* Replay speed that plays samples back as fast as they can be consumed */
+#define REPLAY_SPEED_MAX 0.0
+
+typedef struct {
+  std::string filename;
+  // Multiple of real time, or REPLAY_SPEED_MAX
+  double speed;
+  std::thread thread;
+  // Set by the UI thread to stop the replay early
+  std::atomic<bool> closing;
+  // Set by the replay thread once the whole file has been pushed
+  std::atomic<bool> done;
+  // Lines or frames that could not be decoded to a sample
+  std::atomic<unsigned long> skipped;
+  // Samples read from the file and samples taken by the UI thread
+  std::atomic<unsigned long> produced;
+  unsigned long consumed;
+  // Host time (ms) the replay started at
+  double started;
+  // Recorded time (ms) of the first sample and host time it was played at
+  double firstSample;
+  double firstPlayed;
+  sample_ring_t samples;
+} pip_replay_t;
+
+pip_replay_t* startReplay(const std::string&, double);
+void stopReplay(pip_replay_t*);
+bool parseSampleLine(const std::string&, pip_sample_t&);
+
+#endif
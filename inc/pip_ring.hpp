@@ -0,0 +1,89 @@
+#ifndef PIP_RING_H_
+#define PIP_RING_H_
+/*
+ * Copyright (C) 2014 Robert S. Moore II and Rutgers University
+ * All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA
+ * or visit http://www.gnu.org/licenses/gpl-2.0.html
+ */
+
+/*******************************************************************************
+ * @file pip_ring.hpp
+ * Bounded, lock-free ring buffer for handing samples from exactly one
+ * producer thread to exactly one consumer thread.
+ *
+ * @author Robert S. Moore II
+ ******************************************************************************/
+
+#include <atomic>
+#include <cstddef>
+
+/*
+ * Capacity must be a power of two.  The producer only writes head and the
+ * consumer only writes tail, so neither side needs a lock.  A push into a
+ * full ring fails and is counted as an overflow instead of blocking the
+ * producer.
+ */
+template <typename T, size_t Capacity>
+class SpscRing {
+  public:
+    SpscRing() : head(0), tail(0), overflowCount(0) {
+      static_assert((Capacity & (Capacity - 1)) == 0, "Capacity must be a power of two");
+    }
+
+    // Producer side. Returns false (and counts an overflow) if the ring is full.
+    bool push(const T& item){
+      size_t h = head.load(std::memory_order_relaxed);
+      if(h - tail.load(std::memory_order_acquire) >= Capacity){
+        overflowCount.fetch_add(1, std::memory_order_relaxed);
+        return false;
+      }
+      items[h & (Capacity - 1)] = item;
+      head.store(h + 1, std::memory_order_release);
+      return true;
+    }
+
+    // Consumer side. Returns false if the ring is empty.
+    bool pop(T& item){
+      size_t t = tail.load(std::memory_order_relaxed);
+      if(t == head.load(std::memory_order_acquire)){
+        return false;
+      }
+      item = items[t & (Capacity - 1)];
+      tail.store(t + 1, std::memory_order_release);
+      return true;
+    }
+
+    size_t size() const {
+      return head.load(std::memory_order_acquire) - tail.load(std::memory_order_acquire);
+    }
+
+    unsigned long overflows() const {
+      return overflowCount.load(std::memory_order_relaxed);
+    }
+
+  private:
+    // Keep the producer and consumer indices on separate cache lines.  Padding
+    // rather than alignas since the rings are allocated with plain new.
+    std::atomic<size_t> head;
+    char headPad[64 - sizeof(std::atomic<size_t>)];
+    std::atomic<size_t> tail;
+    char tailPad[64 - sizeof(std::atomic<size_t>)];
+    std::atomic<unsigned long> overflowCount;
+    T items[Capacity];
+};
+
+#endif
@@ -0,0 +1,75 @@
+#ifndef PIP_ROWS_H_
+#define PIP_ROWS_H_
+/*
+ * Copyright (C) 2014 Robert S. Moore II and Rutgers University
+ * All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA
+ * or visit http://www.gnu.org/licenses/gpl-2.0.html
+ */
+
+/*******************************************************************************
+ * @file pip_rows.hpp
+ * Formatted rows of the main list, kept until the tag's sample changes.
+ *
+ * A row is kept as its text and the spans of it drawn in color, so drawing
+ * it is copying characters.  The tag ID is kept in both decimal and hex and
+ * the rest of the row after it once, so switching between ID modes formats
+ * nothing.  The recording mark and the highlight depend on more than the
+ * sample and are added when the row is drawn.  Rows are indexed by the
+ * tag's slot in the tag table and are formatted the first time they are
+ * asked for after the sample changed, so tags that are not on screen cost
+ * nothing.
+ *
+ * @author Robert S. Moore II
+ ******************************************************************************/
+
+#include <vector>
+
+#include <cons_ncurses.hpp>
+
+/* Longest row after the tag ID, and most spans of color in it */
+#define ROW_WIDTH 80
+#define ROW_SPANS 6
+/* Longest tag ID, in decimal */
+#define ROW_ID_WIDTH 12
+
+typedef struct {
+  unsigned char start;
+  unsigned char end;
+  // Color pair of the characters from start up to end
+  short color;
+} row_span_t;
+
+typedef struct {
+  bool valid;
+  char decimalID[ROW_ID_WIDTH];
+  char hexID[ROW_ID_WIDTH];
+  // Row after the tag ID
+  char text[ROW_WIDTH];
+  unsigned char length;
+  unsigned char numSpans;
+  row_span_t spans[ROW_SPANS];
+} tag_row_t;
+
+typedef struct {
+  std::vector<tag_row_t> rows;
+} row_cache_t;
+
+void invalidateRow(row_cache_t&, int);
+void clearRows(row_cache_t&);
+const tag_row_t& formattedRow(row_cache_t&, int, const pip_sample_t&);
+
+#endif
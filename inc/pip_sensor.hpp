@@ -0,0 +1,202 @@
+#ifndef PIP_SENSOR_H_
+#define PIP_SENSOR_H_
+/*
+ * Copyright (C) 2014 Robert S. Moore II and Rutgers University
+ * All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA
+ * or visit http://www.gnu.org/licenses/gpl-2.0.html
+ */
+
+/*******************************************************************************
+ * @file pip_sensor.hpp
+ * Decoders for the "extra data" portion of a Pip packet.
+ *
+ * The first byte of the extra data is a header whose bits say which sensor
+ * blocks follow, in bit order.  Since there are only 256 headers, a decoder
+ * is generated at compile time for every one of them, with the offset of
+ * each block known as a constant and no tests of the header left at run
+ * time.  The decoders are inlined as the cases of one switch on the header.
+ * The length every header needs is known too, so truncated data is
+ * rejected instead of read past.
+ *
+ * @author Robert S. Moore II
+ ******************************************************************************/
+
+#include <stdint.h>
+
+#include <cons_ncurses.hpp>
+
+/*
+ * Sensor blocks, in the order they follow the header.  Bit 0x80 is not
+ * assigned and carries no data.
+ */
+// Binary sensing (doors, water, etc.), temperature in bits 0xFE, offset 40 C
+#define SENSOR_BINARY   0x01
+// Temperature in 16ths of a degree C
+#define SENSOR_TEMP     0x02
+// Ambient light from "dark" (0x00) to bright office (0xFF)
+#define SENSOR_LIGHT    0x04
+// Off-chip temperature and relative humidity, both in 16ths
+#define SENSOR_TEMP_RH  0x08
+// Two byte moisture value
+#define SENSOR_MOISTURE 0x10
+// Six bytes of history, not decoded
+#define SENSOR_HISTORY  0x20
+// Battery voltage in millivolts and Joules consumed since start-up
+#define SENSOR_BATTERY  0x40
+
+/*
+ * Bytes in the block of one sensor bit.
+ */
+constexpr int sensorBlockSize(unsigned int bit){
+  return SENSOR_BINARY == bit ? 1 :
+    SENSOR_TEMP == bit ? 2 :
+    SENSOR_LIGHT == bit ? 1 :
+    SENSOR_TEMP_RH == bit ? 4 :
+    SENSOR_MOISTURE == bit ? 2 :
+    SENSOR_HISTORY == bit ? 6 :
+    SENSOR_BATTERY == bit ? 4 : 0;
+}
+
+/*
+ * Offset of the block for bit from the header byte, that is one for the
+ * header plus the blocks of all lower bits present in hdr.
+ */
+constexpr int sensorBlockOffset(unsigned int hdr, unsigned int bit){
+  return bit <= 1 ? 1 :
+    sensorBlockOffset(hdr, bit >> 1) + ((hdr & (bit >> 1)) ? sensorBlockSize(bit >> 1) : 0);
+}
+
+/*
+ * Bytes of extra data, including the header, that hdr announces.
+ */
+constexpr int sensorDataLength(unsigned int hdr){
+  return sensorBlockOffset(hdr, 0x80);
+}
+
+static_assert(1 == sensorDataLength(0x00), "A bare header is one byte");
+static_assert(10 == sensorDataLength(SENSOR_TEMP_RH | SENSOR_LIGHT | SENSOR_BATTERY),
+    "Temperature/humidity, light and battery take 9 bytes");
+static_assert(21 == sensorDataLength(0x7F), "Every block takes 20 bytes");
+
+/*
+ * Reads a value in 16ths, the whole part in the first byte shifted by 4.
+ */
+inline float sensorSixteenths(const unsigned char* d){
+  return (d[0]<<4) + (d[1]/16.0);
+}
+
+inline int sensorShort(const unsigned char* d){
+  return (d[0]<<8) + d[1];
+}
+
+/*
+ * Decodes the blocks announced by Hdr into s.  The caller has checked that
+ * data holds sensorDataLength(Hdr) bytes.  Later temperature blocks
+ * overwrite earlier ones.
+ */
+template <unsigned int Hdr>
+void decodeSensorBlocks(const unsigned char* data, pip_sample_t& s){
+  if(Hdr & SENSOR_BINARY){
+    constexpr int at = sensorBlockOffset(Hdr, SENSOR_BINARY);
+    s.tempC = (data[at]>>1) - 40;
+  }
+  if(Hdr & SENSOR_TEMP){
+    constexpr int at = sensorBlockOffset(Hdr, SENSOR_TEMP);
+    s.tempC = sensorSixteenths(data + at);
+  }
+  if(Hdr & SENSOR_LIGHT){
+    constexpr int at = sensorBlockOffset(Hdr, SENSOR_LIGHT);
+    s.light = data[at];
+  }
+  if(Hdr & SENSOR_TEMP_RH){
+    constexpr int at = sensorBlockOffset(Hdr, SENSOR_TEMP_RH);
+    s.tempC = sensorSixteenths(data + at);
+    s.rh = sensorSixteenths(data + at + 2);
+  }
+  if(Hdr & SENSOR_MOISTURE){
+    constexpr int at = sensorBlockOffset(Hdr, SENSOR_MOISTURE);
+    s.moisture = sensorShort(data + at);
+  }
+  if(Hdr & SENSOR_BATTERY){
+    constexpr int at = sensorBlockOffset(Hdr, SENSOR_BATTERY);
+    s.batteryMv = sensorShort(data + at)/1000.0;
+    s.batteryJ = sensorShort(data + at + 2);
+  }
+}
+
+/*
+ * Builds the list 0..N-1 of headers to compute a length for.
+ */
+template <unsigned int... Hdr>
+struct sensor_headers {};
+
+template <unsigned int N, unsigned int... Hdr>
+struct make_sensor_headers : make_sensor_headers<N-1, N-1, Hdr...> {};
+
+template <unsigned int... Hdr>
+struct make_sensor_headers<0, Hdr...> {
+  typedef sensor_headers<Hdr...> type;
+};
+
+template <typename Headers>
+struct SensorLengths;
+
+template <unsigned int... Hdr>
+struct SensorLengths<sensor_headers<Hdr...> > {
+  static constexpr uint8_t table[sizeof...(Hdr)] = {sensorDataLength(Hdr)...};
+};
+
+template <unsigned int... Hdr>
+constexpr uint8_t SensorLengths<sensor_headers<Hdr...> >::table[sizeof...(Hdr)];
+
+// Bytes of extra data every header needs, indexed by the header byte
+typedef SensorLengths<make_sensor_headers<256>::type> sensor_lengths;
+
+/*
+ * One case of the switch in decodeSensorData for every header without bit
+ * 0x80, which carries no data.  Each case is its decoder inlined.
+ */
+#define SENSOR_CASE(h) case (h): decodeSensorBlocks<(h)>(data, s); break;
+#define SENSOR_CASES_4(h) SENSOR_CASE(h) SENSOR_CASE((h)+1) SENSOR_CASE((h)+2) SENSOR_CASE((h)+3)
+#define SENSOR_CASES_16(h) SENSOR_CASES_4(h) SENSOR_CASES_4((h)+4) SENSOR_CASES_4((h)+8) SENSOR_CASES_4((h)+12)
+#define SENSOR_CASES_64(h) SENSOR_CASES_16(h) SENSOR_CASES_16((h)+16) SENSOR_CASES_16((h)+32) SENSOR_CASES_16((h)+48)
+
+/*
+ * Decodes length bytes of extra data into s.  Values that are not present
+ * are left alone.  Returns false if the data is shorter than its header
+ * says, in which case nothing is decoded.
+ */
+inline bool decodeSensorData(const unsigned char* data, int length, pip_sample_t& s){
+  if(0 == length){
+    return true;
+  }
+  if(length < sensor_lengths::table[data[0]]){
+    return false;
+  }
+  switch(data[0] & 0x7F){
+    SENSOR_CASES_64(0)
+    SENSOR_CASES_64(64)
+  }
+  return true;
+}
+
+#undef SENSOR_CASES_64
+#undef SENSOR_CASES_16
+#undef SENSOR_CASES_4
+#undef SENSOR_CASE
+
+#endif
@@ -0,0 +1,69 @@
+#ifndef PIP_SIM_H_
+#define PIP_SIM_H_
+/*
+ * Copyright (C) 2014 Robert S. Moore II and Rutgers University
+ * All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA
+ * or visit http://www.gnu.org/licenses/gpl-2.0.html
+ */
+
+/*******************************************************************************
+ * @file pip_sim.hpp
+ * Simulated receivers that generate PIP frames for a population of tags, for
+ * load testing the console without any hardware attached.
+ *
+ * @author Robert S. Moore II
+ ******************************************************************************/
+
+#include <list>
+#include <string>
+
+#include <pip_sensor.hpp>
+#include <pip_usb.hpp>
+
+/* Largest tag population that can be simulated */
+#define SIM_MAX_TAGS 100000
+/* Most simulated receivers, their device numbers start at SIM_DEVICE_BASE */
+#define SIM_MAX_RECEIVERS 16
+#define SIM_DEVICE_BASE 0xFF00
+/* Shortest broadcast period (ms) a tag can be given */
+#define SIM_MIN_PERIOD 1.0
+/* Spread (dB) of a tag's RSSI from one packet to the next */
+#define SIM_RSSI_NOISE 1.0
+
+typedef struct {
+  // Number of tags, split evenly across the receivers
+  int tags;
+  int receivers;
+  // ID of the first tag, the rest are numbered consecutively
+  unsigned int firstID;
+  // Mean broadcast period (ms) and the fraction each tag's period may differ by
+  double period;
+  double spread;
+  // Normal distribution (dBm) the tags' mean RSSI values are drawn from
+  double rssiMean;
+  double rssiDeviation;
+  // Sensor header bits every tag sends
+  unsigned char sensors;
+  unsigned int seed;
+} pip_sim_config_t;
+
+void defaultSimConfig(pip_sim_config_t&);
+bool parseSimConfig(const std::string&, pip_sim_config_t&);
+int simDataLength(unsigned char);
+void startSimulation(std::list<pip_receiver_t*>&, const pip_sim_config_t&);
+
+#endif
@@ -0,0 +1,133 @@
+#ifndef PIP_STATE_H_
+#define PIP_STATE_H_
+/*
+ * Copyright (C) 2014 Robert S. Moore II and Rutgers University
+ * All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA
+ * or visit http://www.gnu.org/licenses/gpl-2.0.html
+ */
+
+/*******************************************************************************
+ * @file pip_state.hpp
+ * Checkpoints of the console state in a memory-mapped file, so that a
+ * restarted console carries on with the tags, broadcast periods and history
+ * it had.
+ *
+ * A state file is a header followed by sections that are the console's own
+ * arrays, byte for byte: the tag table's samples, the history arena and its
+ * rings, the recency list, and the archive's blocks.  Loading maps the file
+ * and copies each section into place, nothing is parsed.  The orders of the
+ * main list are not saved but rebuilt from the samples.  Every index read
+ * back is checked and every archive block is decoded once, so a damaged
+ * file cannot leave the console walking a broken structure.  The header records the version and the sizes the layout
+ * depends on, and a file written with any other layout is not used.
+ *
+ * Checkpoints are written to a new file that is synced to disk before it
+ * replaces the old one, so a crash leaves the previous checkpoint intact.
+ * For periodic checkpoints the console only copies its state into an image
+ * of the file, which the writer thread of pip_writer.hpp writes and syncs
+ * while the console goes on.
+ *
+ * @author Robert S. Moore II
+ ******************************************************************************/
+
+#include <stdint.h>
+
+#include <string>
+#include <vector>
+
+#include <pip_aging.hpp>
+#include <pip_archive.hpp>
+#include <pip_history.hpp>
+#include <pip_tags.hpp>
+
+#define STATE_MAGIC "PIPSTATE"
+#define STATE_VERSION 3
+/* Written in the machine's byte order, to recognize files from another */
+#define STATE_BYTE_ORDER 0x01020304
+
+/* Results of loading a state file */
+#define STATE_LOADED 0
+#define STATE_MISSING 1
+#define STATE_INCOMPATIBLE 2
+#define STATE_DAMAGED 3
+
+/* Sections of a state file */
+#define STATE_SAMPLES 0
+#define STATE_FREE_SLOTS 1
+#define STATE_RINGS 2
+#define STATE_ARENA 3
+#define STATE_FREE_BLOCKS 4
+#define STATE_NEWER 5
+#define STATE_OLDER 6
+#define STATE_ARCHIVE_TAGS 7
+#define STATE_ARCHIVE_BLOCKS 8
+#define STATE_ARCHIVE_BYTES 9
+#define STATE_SECTIONS 10
+
+typedef struct {
+  // Bytes from the start of the file, and elements in the section
+  uint64_t offset;
+  uint64_t count;
+} state_section_t;
+
+typedef struct {
+  char magic[8];
+  uint32_t version;
+  uint32_t byteOrder;
+  // Sizes the layout depends on
+  uint32_t sampleSize;
+  uint32_t historyBlock;
+  uint32_t historyBlocks;
+  uint32_t archiveBlock;
+  uint32_t archiveColumns;
+  // Aging clock and counts
+  int64_t now;
+  uint64_t expired;
+  uint64_t evicted;
+  uint64_t archiveSamples;
+  uint64_t archiveBytes;
+  state_section_t sections[STATE_SECTIONS];
+} state_header_t;
+
+/*
+ * Archive of one tag.  Its sealed blocks follow those of the tags before it
+ * in STATE_ARCHIVE_BLOCKS, and the data of those blocks, then its open
+ * columns, follow that of the tags before it in STATE_ARCHIVE_BYTES.
+ */
+typedef struct {
+  int32_t tagID;
+  uint32_t sealed;
+  uint32_t open[ARCHIVE_COLUMNS];
+  int64_t openFirst;
+  int32_t openCount;
+  int32_t runLength;
+  archive_state_t state;
+  uint8_t runBits;
+} state_archive_tag_t;
+
+typedef struct {
+  int64_t firstTime;
+  uint16_t end[ARCHIVE_COLUMNS];
+} state_archive_block_t;
+
+bool saveState(const std::string&, const tag_table_t&, const history_arena_t&,
+    const archive_t&, const tag_aging_t&);
+int loadState(const std::string&, tag_table_t&, history_arena_t&, archive_t&, tag_aging_t&);
+void stateImage(const tag_table_t&, const history_arena_t&, const archive_t&, const tag_aging_t&,
+    std::vector<unsigned char>&);
+
+#endif
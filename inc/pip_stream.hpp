@@ -0,0 +1,85 @@
+#ifndef PIP_STREAM_H_
+#define PIP_STREAM_H_
+/*
+ * Copyright (C) 2014 Robert S. Moore II and Rutgers University
+ * All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA
+ * or visit http://www.gnu.org/licenses/gpl-2.0.html
+ */
+
+/*******************************************************************************
+ * @file pip_stream.hpp
+ * Streams decoded samples to a file or descriptor when running headless,
+ * either as text lines or as fixed-size binary records.
+ *
+ * A binary stream is a stream_header_t followed by stream_record_t records,
+ * all little endian as written by the host.  A text stream is one line per
+ * sample:
+ *   Timestamp (ms),Tag ID,RSSI,Temp,RH,Light,Moisture,Battery (V),Battery (J)
+ * with empty fields for values the sample does not have.
+ *
+ * The two formats keep time at different resolutions.  Text timestamps are
+ * milliseconds since 1970, truncated, the same as in recordings.  Binary
+ * records keep the host time in microseconds, as it was taken.
+ *
+ * @author Robert S. Moore II
+ ******************************************************************************/
+
+#include <stdint.h>
+
+#include <string>
+
+#include <cons_ncurses.hpp>
+
+#define STREAM_MAGIC "PIPSTRM\n"
+#define STREAM_VERSION 1
+
+#define STREAM_TEXT 0
+#define STREAM_BINARY 1
+
+/* Bytes buffered before the stream is written out */
+#define STREAM_BUFFER_SIZE (64 * 1024)
+
+typedef struct {
+  char magic[8];
+  uint32_t version;
+  // sizeof(stream_record_t) when the stream was written
+  uint32_t recordSize;
+} __attribute__((packed)) stream_header_t;
+
+/*
+ * One sample.  Values the sample does not have keep the sentinels set by
+ * initPipData.
+ */
+typedef struct {
+  // Host time the sample was received, microseconds since 1970
+  uint64_t time;
+  uint32_t tagID;
+  float rssi;
+  float tempC;
+  float rh;
+  float batteryMv;
+  int32_t light;
+  int32_t moisture;
+  int32_t batteryJ;
+} __attribute__((packed)) stream_record_t;
+
+bool openStream(const std::string&, int);
+void streamSample(const pip_sample_t&);
+bool flushStream();
+void closeStream();
+
+#endif
@@ -0,0 +1,108 @@
+#ifndef PIP_TAGS_H_
+#define PIP_TAGS_H_
+/*
+ * Copyright (C) 2014 Robert S. Moore II and Rutgers University
+ * All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA
+ * or visit http://www.gnu.org/licenses/gpl-2.0.html
+ */
+
+/*******************************************************************************
+ * @file pip_tags.hpp
+ * Table of the latest sample from every tag heard.
+ *
+ * Samples live in a dense array of slots, found by tag ID through a hash
+ * index.  The order the tags are listed in is kept by a treap over the slots
+ * in which every node knows the size of its subtree, so that the row of a
+ * tag and the tag at a row are both found in O(log n).  Besides the order
+ * by ID, only the order the list is sorted by is kept, and a tag only moves
+ * in it when its sort key changed.  Sorting differently builds the new order
+ * from the table once.
+ *
+ * Slot 0 is never used.  It stands for "no tag" and is the treap's empty
+ * subtree, which also makes a zero-initialized table an empty one.
+ *
+ * @author Robert S. Moore II
+ ******************************************************************************/
+
+#include <unordered_map>
+#include <vector>
+
+#include <cons_ncurses.hpp>
+
+typedef struct {
+  int left;
+  int right;
+  unsigned int priority;
+  // Nodes in the subtree rooted here, 0 for slot 0
+  int size;
+  // Value the slot is listed by in a keyed order
+  double key;
+} tag_node_t;
+
+/*
+ * One listing order of the tags, a treap whose nodes are indexed by slot.
+ * It lists slots by tag ID, or if it is keyed by the key stored in their
+ * node when they were inserted, ties broken by tag ID.
+ */
+typedef struct {
+  bool keyed;
+  int root;
+  // State of the generator that hands out node priorities
+  unsigned int seed;
+  std::vector<tag_node_t> nodes;
+} tag_order_t;
+
+/* Orders the main list can be sorted in */
+#define SORT_ID 0
+#define SORT_RSSI 1
+#define SORT_LAST_SEEN 2
+#define SORT_BATTERY 3
+#define SORT_TEMPERATURE 4
+#define SORT_PERIOD 5
+#define SORT_CONFIDENCE 6
+#define SORT_ORDERS 7
+
+typedef struct {
+  // Latest sample of each tag, by slot
+  std::vector<pip_sample_t> samples;
+  std::vector<int> freeSlots;
+  // Slot of each tag ID
+  std::unordered_map<int,int> slots;
+  // Rows of the main list by ID and in the order it is listed in, the
+  // other orders are empty
+  tag_order_t orders[SORT_ORDERS];
+  int sort;
+} tag_table_t;
+
+void orderInsert(tag_order_t&, const std::vector<pip_sample_t>&, int);
+void orderInsertKey(tag_order_t&, const std::vector<pip_sample_t>&, int, double);
+void orderErase(tag_order_t&, const std::vector<pip_sample_t>&, int);
+int orderRank(const tag_order_t&, const std::vector<pip_sample_t>&, int);
+int orderSelect(const tag_order_t&, int);
+
+int findTag(const tag_table_t&, int);
+int insertTag(tag_table_t&, int);
+bool removeTag(tag_table_t&, int);
+int tagAfterUpdate(tag_table_t&, int);
+void rebuildSortOrders(tag_table_t&);
+void sortTags(tag_table_t&, int);
+int tagRow(const tag_table_t&, int);
+int tagAtRow(const tag_table_t&, int);
+int slotAtRow(const tag_table_t&, int);
+int tagCount(const tag_table_t&);
+
+#endif
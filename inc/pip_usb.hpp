@@ -0,0 +1,252 @@
+#ifndef PIP_USB_H_
+#define PIP_USB_H_
+/*
+ * Copyright (c) 2012 Bernhard Firner and Rutgers University
+ * Copyright (C) 2014 Robert S. Moore II and Rutgers University
+ * All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA
+ * or visit http://www.gnu.org/licenses/gpl-2.0.html
+ */
+
+/*******************************************************************************
+ * @file pip_usb.hpp
+ * Asynchronous acquisition of packets from PIP receivers over libusb.  Each
+ * receiver is served by its own thread and libusb context and hands decoded
+ * samples to the UI thread through a ring buffer.
+ *
+ * @author Bernhard Firner
+ * @author Robert S. Moore II
+ ******************************************************************************/
+
+#include <libusb-1.0/libusb.h>
+#include <stdint.h>
+#include <sys/time.h>
+
+#include <atomic>
+#include <list>
+#include <thread>
+
+#include <cons_ncurses.hpp>
+#include <pip_capture.hpp>
+#include <pip_ring.hpp>
+
+/* #defines of the commands to the pipsqueak tag */
+#define LM_GET_NEXT_PACKET (0x13)
+
+/* Defined in CC1100 data sheet/errata. */
+#define RSSI_OFFSET 78
+
+/* Length of a PIP packet without the optional data segment */
+#define PACKET_LEN 13
+/* Maximum length of the optional data segment */
+#define PACKET_EXTRA_LEN 20
+
+//0 for 2.X tags, 1 for GPIP
+#define OLD_PIP 0
+#define GPIP 1
+#define NOT_PIP -1
+
+/*
+ * Number of request/read transfer pairs kept queued on each receiver.
+ * More pairs let the host drain the receiver queue faster than one
+ * round trip per packet.
+ */
+#define PIP_TRANSFER_DEPTH 4
+/* Timeout (ms) for a single request or read transfer */
+#define PIP_TRANSFER_TIMEOUT 100
+/* Delay (ms) before re-requesting from a receiver that had nothing to send */
+#define PIP_IDLE_DELAY 1.0
+/* Longest delay (ms) the idle delay backs off to while a receiver stays quiet */
+#define PIP_IDLE_DELAY_MAX 32.0
+/* Consecutive failed transfers before a receiver is reconnected */
+#define PIP_MAX_FAILURES 3
+
+/* Receiver lifecycle, see run() in pip_usb.cpp */
+#define PIP_STATE_OPENING 0
+#define PIP_STATE_ACTIVE 1
+#define PIP_STATE_BACKOFF 2
+#define PIP_STATE_RESET 3
+#define PIP_STATE_FAILED 4
+/* Delay (ms) before the first reconnect, doubling up to the maximum */
+#define PIP_BACKOFF_MIN 250.0
+#define PIP_BACKOFF_MAX 30000.0
+/* Reconnects tried without a single good read before a receiver is given up */
+#define PIP_MAX_RECONNECTS 10
+/* Decoded samples a receiver can buffer for the UI thread (power of two) */
+#define PIP_RING_SIZE 4096
+/*
+ * Request to read latency histogram.  Bucket 0 counts round trips shorter
+ * than PIP_LATENCY_BASE microseconds and each bucket after it twice as long,
+ * the last bucket counts everything longer.
+ */
+#define PIP_LATENCY_BUCKETS 16
+#define PIP_LATENCY_BASE 128
+/* Errors are counted by libusb code, 0 to -12, with everything else last */
+#define PIP_ERROR_CODES 14
+
+//PIP 3 Byte ID packet structure with variable data segment.
+//3 Byte receiver ID, 21 bit transmitter id, 3 bits of parity plus up to 20 bytes of extra data.
+typedef struct {
+	unsigned char ex_length : 8; //Length of data in the optional data portion
+	unsigned char dropped   : 8; //The number of packet that were dropped if the queue overflowed.
+	unsigned int boardID    : 24;//Basestation ID
+	unsigned int time       : 32;//Timestamp in quarter microseconds.
+	unsigned int tagID      : 24;//Transmitter ID
+//	unsigned int parity     : 3; //Even parity check on the transmitter ID
+	unsigned char rssi      : 8; //Received signal strength indicator
+  unsigned char lqi       : 7; //The lower 7 bits contain the link quality indicator
+	unsigned char crcok     : 1;
+	unsigned char data[20];      //The optional variable length data segment
+  float rss;
+} __attribute__((packed)) pip_packet_t;
+
+/*
+ * Size of one transfer buffer.  A frame is the extra data length byte
+ * followed by at most PACKET_LEN+PACKET_EXTRA_LEN bytes from the PIP, and
+ * the buffer is big enough to overlay a pip_packet_t on it.
+ */
+#define PIP_FRAME_SIZE (sizeof(pip_packet_t))
+
+struct pip_receiver;
+
+/*
+ * One queued request (LM_GET_NEXT_PACKET) and the read that collects the
+ * receiver's answer to it.
+ */
+typedef struct {
+  struct pip_receiver* receiver;
+  libusb_transfer* request;
+  libusb_transfer* read;
+  bool requestBusy;
+  bool readBusy;
+  // True if the last read returned a packet, so the slot is re-armed at once
+  bool gotFrame;
+  // Time (ms) the request was submitted, for the latency histogram
+  double requested;
+  // Time (ms) at which an idle slot should be re-armed, 0 if not idle
+  double idleUntil;
+  unsigned char cmd;
+  // This slot's buffer in the receiver's frame pool
+  unsigned char* buf;
+} pip_slot_t;
+
+// Decoded samples handed from a producer thread to the UI thread
+typedef SpscRing<pip_sample_t, PIP_RING_SIZE> sample_ring_t;
+// Raw frames handed to the UI thread for the capture file
+typedef SpscRing<capture_record_t, PIP_RING_SIZE> capture_ring_t;
+
+/*
+ * Health counters of one receiver.  Written by its acquisition thread and
+ * read by the UI thread.
+ */
+typedef struct {
+  // LM_GET_NEXT_PACKET requests submitted
+  std::atomic<unsigned long> requests;
+  // Reads that completed without a frame
+  std::atomic<unsigned long> emptyReads;
+  // Reads that completed with only part of a frame, which was dropped
+  std::atomic<unsigned long> partialReads;
+  std::atomic<unsigned long> timeouts;
+  // Failures the receiver survived, after which the slot was tried again
+  std::atomic<unsigned long> retries;
+  // Times the receiver was given a fresh context and opened again
+  std::atomic<unsigned long> reconnects;
+  // Microseconds from attaching until the receiver was first up, 0 until then
+  std::atomic<unsigned long> startupUs;
+  // Microseconds the last (re)open took: reset, configuration and claim
+  std::atomic<unsigned long> openUs;
+  // Packets the receiver reported dropping from its own queue
+  std::atomic<unsigned long> dropped;
+  // Bytes of every frame read
+  std::atomic<unsigned long> bytes;
+  // Failures by libusb error code, see PIP_ERROR_CODES
+  std::atomic<unsigned long> errors[PIP_ERROR_CODES];
+  std::atomic<unsigned long> latency[PIP_LATENCY_BUCKETS];
+} pip_health_t;
+
+typedef struct pip_receiver {
+  // Context private to this receiver so only its own thread handles its events.
+  // Replaced on every reconnect, NULL for simulated receivers.
+  libusb_context* ctx;
+  // NULL while the receiver is not connected and for simulated receivers
+  libusb_device_handle* handle;
+  // Where the device was found, used to open it again after a failure
+  int bus;
+  int address;
+  // Combination of bus number and the address on the bus
+  int deviceNum;
+  int8_t version;
+  // One of PIP_STATE_*, only changed by the receiver's thread
+  std::atomic<int> state;
+  // Delay (ms) before the next reconnect and reconnects since the last good read
+  double backoff;
+  int reconnectAttempts;
+  // Host time (ms) the receiver was attached, and whether the UI thread has
+  // reported it up (UI thread only)
+  double created;
+  bool announced;
+  // Number of submitted transfers that have not completed yet
+  int inFlight;
+  int failures;
+  // Current delay (ms) before re-requesting after an empty read
+  double idleDelay;
+  // Samples were pushed since the UI thread was last woken
+  bool pushed;
+  // Host time shared by all frames handled in the current batch, that is one
+  // pass of handling events, and whether it was taken yet
+  timeval batchTime;
+  bool batchTimed;
+  // Non-zero libusb error code once the connection failed
+  std::atomic<int> error;
+  // Set by the UI thread to stop the acquisition thread
+  std::atomic<bool> closing;
+  // Set by the acquisition thread once it has finished, after which
+  // closePIP does not wait
+  std::atomic<bool> stopped;
+  std::thread thread;
+  // Decoded samples waiting for the UI thread
+  sample_ring_t samples;
+  // Raw frames waiting to be captured, only filled while capturing
+  capture_ring_t captures;
+  // Ring overflows already reported to the user (UI thread only)
+  unsigned long overflowsSeen;
+  unsigned long captureOverflowsSeen;
+  // Frames decoded, and frame bytes copied out of transfer buffers doing so
+  std::atomic<unsigned long> frames;
+  std::atomic<unsigned long> bytesCopied;
+  pip_health_t health;
+  pip_slot_t slots[PIP_TRANSFER_DEPTH];
+  // Transfer buffers, reused for every read.  Frames are decoded in place and
+  // never cleared or copied.
+  unsigned char framePool[PIP_TRANSFER_DEPTH][PIP_FRAME_SIZE];
+} pip_receiver_t;
+
+void attachPIPs(std::list<pip_receiver_t*>&);
+bool watchPIPs();
+void updatePIPs(std::list<pip_receiver_t*>&);
+void closePIP(pip_receiver_t*);
+
+int pipWakeFd();
+void wakePIPs();
+void clearPIPWake();
+
+bool decodeFrame(const unsigned char*, int, const timeval&, pip_sample_t&);
+void handleFrame(pip_receiver_t*, unsigned char*, int);
+
+// Set while raw frames should be handed out for capturing
+extern std::atomic<bool> capturingFrames;
+
+#endif
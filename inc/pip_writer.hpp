@@ -0,0 +1,64 @@
+#ifndef PIP_WRITER_H_
+#define PIP_WRITER_H_
+/*
+ * Copyright (C) 2014 Robert S. Moore II and Rutgers University
+ * All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA
+ * or visit http://www.gnu.org/licenses/gpl-2.0.html
+ */
+
+/*******************************************************************************
+ * @file pip_writer.hpp
+ * Files written in the background, so that the UI thread never waits for
+ * the disk.
+ *
+ * The UI thread prepares the whole contents of a file in memory and queues
+ * it.  A writer thread writes the queued files one after another, each to
+ * a new file that is synced to disk before it replaces the old one, so a
+ * crash leaves either the old file or the new one.  Files queued while the
+ * thread is busy are written by the next thread, which finishWrites starts
+ * once the current one is done.  Only the UI thread calls these functions.
+ *
+ * @author Robert S. Moore II
+ ******************************************************************************/
+
+#include <atomic>
+#include <string>
+#include <thread>
+#include <vector>
+
+typedef struct {
+  std::string path;
+  std::vector<unsigned char> data;
+  // Set by the writer thread if the file could not be written
+  bool failed;
+} write_job_t;
+
+typedef struct {
+  std::thread thread;
+  // Files the thread is writing, and files queued after them
+  std::vector<write_job_t> writing;
+  std::vector<write_job_t> queued;
+  // Set by the writer thread once every file it was given is written
+  std::atomic<bool> done;
+} file_writer_t;
+
+bool writeFile(const std::string&, const std::vector<unsigned char>&);
+void queueWrite(file_writer_t&, const std::string&, std::vector<unsigned char>&);
+bool writePending(const file_writer_t&, const std::string&);
+void finishWrites(file_writer_t&, bool, std::vector<std::string>&);
+
+#endif
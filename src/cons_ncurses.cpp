@@ -40,6 +40,13 @@
 #include <panel.h>
 #include <ncurses.h>
 #include <cons_ncurses.hpp>
+#include <pip_aging.hpp>
+#include <pip_archive.hpp>
+#include <pip_history.hpp>
+#include <pip_rows.hpp>
+#include <pip_state.hpp>
+#include <pip_tags.hpp>
+#include <pip_writer.hpp>
 
 #include <iostream>
 #include <fstream>
@@ -60,9 +67,6 @@
 //Handle interrupt signals to exit cleanly.
 #include <signal.h>
 
-// Maximum number if history packets per tag
-#define MAX_HISTORY 1000
-
 
 
 using std::string;
@@ -71,10 +75,39 @@ using std::map;
 using std::pair;
 
 std::set<int> recordedIds;
-map<int,pip_sample_t> latestSample;
-map<int,list<pip_sample_t>> history;
-list<pip_sample_t> histCopy;
+tag_table_t tags;
+history_arena_t history;
+archive_t archive;
+tag_aging_t aging;
+row_cache_t rowCache;
+// Writes checkpoints and the snapshots of expired tags in the background
+file_writer_t writer;
+// File the background checkpoints are written to
+std::string checkpointPath;
+// Tag slot shown in the history panel, the number (see historyTotal) of the
+// newest sample it shows, and whether that follows new samples
+int historySlot = 0;
+unsigned long historyNewest = 0;
+bool historyFollow = true;
 int mainHighlightId = -1;
+// What changed since the last frame: rows of these tag IDs and the rows
+// from frameFirst to frameLast, which tags moved across, or with frameList
+// every row on screen, and the history panel.  frameDrawn says
+// that windows were drawn outside a frame, by a status message or a timer,
+// and the terminal does not show them yet.
+std::set<int> frameIds;
+int frameFirst = 0;
+int frameLast = -1;
+bool frameList = false;
+bool frameHistory = false;
+bool frameDrawn = false;
+bool framePending = false;
+int frameDropped = 0;
+// Newest sample, for the screen saver
+pip_sample_t frameSample;
+timeval lastFrame;
+// Least milliseconds between frames
+long frameInterval = 1000 / FRAME_RATE;
 std::ofstream recordFile;
 pair<int,int> displayBounds(0,0);
 
@@ -89,7 +122,11 @@ PANEL* historyPanel;
 WINDOW* statusWindow;
 PANEL* statusPanel;
 
+WINDOW* receiverWindow;
+PANEL* receiverPanel;
+
 bool isShowHistory = false;
+bool isShowReceivers = false;
 extern bool killed;
 bool showHexIds = false;
 
@@ -137,8 +174,9 @@ void setStatus(std::string message){
   }
   wprintw(statusWindow,message.c_str());
 
+  // Shown by the next frame, or at once after keys
   wnoutrefresh(statusWindow);
-  doupdate();
+  frameDrawn = true;
 }
 
 void initPipData(pip_sample_t& s){
@@ -198,6 +236,43 @@ void toggleRecording(int tagId){
 }
 
 int historyPanelOffset = 0;
+// Row number being typed to jump to, 0 if none
+int historyJump = 0;
+
+/*
+ * Histories are read from the tag's history ring and archive in place, as
+ * rows counted back from sample number newest (see historyTotal).  A row's
+ * age in the live history is the samples received since then plus the row.
+ */
+static int historyAge(int slot,unsigned long newest,int row){
+  return historyTotal(history,slot) - newest + row;
+}
+
+static int historyRows(int slot,unsigned long newest){
+  int stored = std::max((size_t)historyCount(history,slot),archiveCount(archive,slot));
+  return std::max(0,stored - historyAge(slot,newest,0));
+}
+
+/*
+ * Returns a row of a tag's history, from the ring while it reaches back
+ * that far and from the archive after that.
+ */
+static const pip_sample_t& historyRow(int slot,unsigned long newest,int row){
+  int age = historyAge(slot,newest,row);
+  if(age < historyCount(history,slot)){
+    return historySample(history,slot,age);
+  }
+  return archivedSample(archive,slot,age);
+}
+
+// Rows of the history panel
+static int historyRows(){
+  return historyRows(historySlot,historyNewest);
+}
+
+static const pip_sample_t& historyRow(int row){
+  return historyRow(historySlot,historyNewest,row);
+}
 
 void paintHistoryLine(WINDOW* win,pip_sample_t pkt){
 //      wclrtoeol(win);
@@ -290,7 +365,13 @@ void renderHistoryPanel(){
   wprintw(historyWindow,buff);
   wattroff(historyWindow,A_BOLD);
 
-  if(histCopy.empty()){
+  // Size of the archive along the bottom border
+  slen = snprintf(buff,79," %s%lu archived, %.1f bytes/sample ",historyFollow ? "Following, " : "",
+      (unsigned long)archiveCount(archive,historySlot),archiveBytesPerSample(archive));
+  wmove(historyWindow,lines-1,cols-slen-2);
+  wprintw(historyWindow,buff);
+
+  if(0 == historyRows()){
     return;
   }
 
@@ -300,7 +381,7 @@ void renderHistoryPanel(){
 
   bool scroll = false;
 
-  if((historyPanelOffset > 0) or (historyPanelOffset + (lastDrawRow-drawRow) + 1 ) < histCopy.size()){
+  if((historyPanelOffset > 0) or (historyPanelOffset + (lastDrawRow-drawRow) + 1 ) < historyRows()){
     // "Up arrow" if offset != 0
     wmove(historyWindow,drawRow,1);
     waddch(historyWindow,'^'|A_BOLD|COLOR_PAIR(COLOR_SCROLL_ARROW));
@@ -320,13 +401,13 @@ void renderHistoryPanel(){
     // If start = 2, end = 29, then 28 out of 30 can be used
     int maxSize = displayedRows - 2;
     // Fraction of displayed content versus total
-    int scrollSize = maxSize * (((float)displayedRows)/histCopy.size());
+    int scrollSize = maxSize * (((float)displayedRows)/historyRows());
     if(scrollSize == 0){
       scrollSize = 1;
     }
     
     // "Maximum" offset of scrolled window, based on history list
-    int maxOffset = histCopy.size() - displayedRows;
+    int maxOffset = historyRows() - displayedRows;
     if(maxOffset < 0){
       maxOffset = 0;
     }
@@ -348,78 +429,61 @@ void renderHistoryPanel(){
   wattron(historyWindow,A_BOLD);
   wprintw(historyWindow,"Date/Time                 RSSI   Temp (C) Rel. Hum. Lt  Mst   Batt  Joul");
   wattroff(historyWindow,A_BOLD);
-  list<pip_sample_t>::iterator it = histCopy.begin();
-  // Step through the data list 
-  for(int i = 0; i < historyPanelOffset and it != histCopy.end(); ++i, it++){}
-  for(; drawRow <= lastDrawRow and it != histCopy.end(); it++, ++drawRow){
+  int rows = historyRows();
+  for(int row = historyPanelOffset; drawRow <= lastDrawRow and row < rows; ++row, ++drawRow){
     if(drawRow >= scrollStart and drawRow < scrollEnd){
       wmove(historyWindow,drawRow,1);
       waddch(historyWindow,' '|A_BOLD|COLOR_PAIR(COLOR_SCROLL_ARROW));
     }
     wmove(historyWindow,drawRow,3);
-    paintHistoryLine(historyWindow,*it);
+    paintHistoryLine(historyWindow,historyRow(row));
   }
 }
 
 /*
- * Delete a sensor row from the main list.
+ * Removes a sensor with its history, moving the highlight off it.  Returns
+ * false if there is no such sensor.
  */
-void deleteSensor(int sensorId){
-  if(sensorId < 0){
-    return;
-  }
-
+static bool removeSensor(int sensorId){
   // Determine the row the sensor is at
-  map<int,pip_sample_t>::iterator it = latestSample.begin();
-  int sensorRow = -1;
-  for(int i = 0; it != latestSample.end(); ++i, it++){
-    if(sensorId == it->first){
-      sensorRow = i;
-      break;
-    }
-  }
+  int sensorRow = tagRow(tags,sensorId);
 
   // Could not find the sensor ID for some reason...
   if(sensorRow < 0){
-    return;
+    return false;
   }
 
-  // "it" is now pointing to the sensor to be deleted
-  
   // Need to see if highlightId should be updated
   if(sensorId == mainHighlightId){
     // First check "down"
-    if(std::distance(it,latestSample.end()) > 1){
-      auto oldIt = it;
-      it++;
-      mainHighlightId = it->first;
-      latestSample.erase(oldIt);
-    }
-    // Check "up"
-    else if(std::distance(latestSample.begin(),it) > 0){
-      auto oldIt = it;
-      it--;
-      mainHighlightId = it->first;
-      latestSample.erase(oldIt);
+    if(sensorRow + 1 < tagCount(tags)){
+      mainHighlightId = tagAtRow(tags,sensorRow+1);
     }
-    // This was the only entry?
+    // Check "up", or this was the only entry
     else {
-      latestSample.erase(it);
-      mainHighlightId = -1;
+      mainHighlightId = tagAtRow(tags,sensorRow-1);
     }
   }
-  // Not the highlighted ID, so no worries about updating highlight
-  else {
-    latestSample.erase(it);
+  int slot = findTag(tags,sensorId);
+  agingForget(aging,tags,slot);
+  clearHistory(history,slot);
+  clearArchive(archive,slot);
+  removeTag(tags,sensorId);
+  return true;
+}
+
+/*
+ * Delete a sensor row from the main list.
+ */
+void deleteSensor(int sensorId){
+  if(sensorId < 0 or not removeSensor(sensorId)){
+    return;
   }
-  
 
   // Remove that row
-  history.erase(sensorId);
   updateStatusList(mainWindow);
   setStatus("Deleted 1 sensor");
   update_panels();
-  repaint();
 
 }
 
@@ -432,7 +496,23 @@ void hideHistory(){
   updateStatusList(mainWindow);
   setStatus(STATUS_INFO_KEYS);
   update_panels();
-  repaint();
+}
+
+/*
+ * Moves a following history panel up to the newest sample of its tag.  Rows
+ * already on screen keep their place unless the panel is at the top, where
+ * the new samples appear.  Returns true if the panel has new rows.
+ */
+bool followHistory(){
+  unsigned long total = historyTotal(history,historySlot);
+  if(not historyFollow or total == historyNewest){
+    return false;
+  }
+  if(historyPanelOffset > 0){
+    historyPanelOffset += total - historyNewest;
+  }
+  historyNewest = total;
+  return true;
 }
 
 void showHistory(int historyId){
@@ -440,9 +520,9 @@ void showHistory(int historyId){
     return; 
   }
   historyPanelOffset = 0;
-  //populate the history panel
-
-  histCopy = history[historyId];
+  historyJump = 0;
+  historySlot = findTag(tags,historyId);
+  historyNewest = historyTotal(history,historySlot);
   isShowHistory = true;
 
   show_panel(historyPanel);
@@ -453,10 +533,43 @@ void showHistory(int historyId){
   renderHistoryPanel();
 
   update_panels();
-  repaint();
+}
+
+/*
+ * Scrolls the history panel so that row is at the top, or as near the top
+ * as a full screen of rows allows.  Rows are read by index, so this takes
+ * as long wherever the row is.
+ */
+static void jumpHistory(int row){
+  int screenRows = getMaxRow(historyWindow) - getMinRow(historyWindow) + 1;
+  historyPanelOffset = std::max(0,std::min(row,historyRows() - screenRows));
+  renderHistoryPanel();
 }
 
 void handleHistoryInput(int userKey){
+  // Digits type a row number, which Enter jumps to and Esc forgets
+  if(userKey >= '0' and userKey <= '9'){
+    if(historyJump < 100000000){
+      historyJump = historyJump*10 + (userKey - '0');
+    }
+    char buff[80];
+    snprintf(buff,79,"Jump to row %d of %d: Enter to jump, Esc to cancel.",historyJump,historyRows());
+    setStatus(buff);
+    return;
+  }
+  if(0 < historyJump){
+    int row = historyJump;
+    historyJump = 0;
+    setStatus(STATUS_INFO_HISTORY);
+    if(userKey == '\n' or userKey == '\r' or userKey == KEY_ENTER){
+      jumpHistory(row - 1);
+      return;
+    }
+    if(userKey == 27){
+      getch();
+      return;
+    }
+  }
   switch(userKey){
     case 27:  // ESC or ALT key
       userKey = getch();
@@ -467,18 +580,16 @@ void handleHistoryInput(int userKey){
     case KEY_HOME:
       historyPanelOffset = 0;
       renderHistoryPanel();
-      repaint();
       break;
     case KEY_END:
       {
         
-        if(!histCopy.empty()){
-          historyPanelOffset = std::distance(histCopy.begin(),histCopy.end()) - getMaxRow(historyWindow) + getMinRow(historyWindow)-1;
+        if(0 < historyRows()){
+          historyPanelOffset = historyRows() - getMaxRow(historyWindow) + getMinRow(historyWindow)-1;
           if(historyPanelOffset < 0){
             historyPanelOffset = 0;
           }
           renderHistoryPanel();
-          repaint();
         }
       }
       break;
@@ -489,7 +600,6 @@ void handleHistoryInput(int userKey){
           historyPanelOffset = 0;
         }
         renderHistoryPanel();
-        repaint();
       }
       break;
     case KEY_PPAGE:
@@ -499,13 +609,12 @@ void handleHistoryInput(int userKey){
           historyPanelOffset = 0;
         }
         renderHistoryPanel();
-        repaint();
       }
       break;
     case KEY_DOWN:
       {
         int screenRows = getMaxRow(historyWindow) - getMinRow(historyWindow)+1;
-        int histSize = histCopy.size();
+        int histSize = historyRows();
         if(histSize > screenRows){
           historyPanelOffset++;
           
@@ -514,14 +623,13 @@ void handleHistoryInput(int userKey){
             historyPanelOffset = maxOffset;
           }
           renderHistoryPanel();
-          repaint();
         }
       }
       break;
     case KEY_NPAGE:
       {
         int screenRows = getMaxRow(historyWindow) - getMinRow(historyWindow);
-        int histSize = histCopy.size();
+        int histSize = historyRows();
         if(histSize > screenRows){
           historyPanelOffset += screenRows;
           int maxOffset = histSize - screenRows -1;
@@ -529,7 +637,6 @@ void handleHistoryInput(int userKey){
             historyPanelOffset = maxOffset;
           }
           renderHistoryPanel();
-          repaint();
         }
       }
 
@@ -539,11 +646,17 @@ void handleHistoryInput(int userKey){
       showHexIds = !showHexIds;
       setStatus(showHexIds ? "Changed to hex mode." : "Changed to decimal mode.");
       renderHistoryPanel();
-      repaint();
       break;
    case 's':
    case 'S':
-      saveHistory(histCopy);
+      saveHistory();
+     break;
+   case 'f':
+   case 'F':
+      historyFollow = !historyFollow;
+      followHistory();
+      setStatus(historyFollow ? "Following new packets." : "Stopped following new packets.");
+      renderHistoryPanel();
      break;
  
   }
@@ -551,6 +664,187 @@ void handleHistoryInput(int userKey){
 
 }
 
+int receiverPanelOffset = 0;
+
+/*
+ * Draws the receiver health report, one report line per row.
+ */
+void renderReceiverPanel(){
+  werase(receiverWindow);
+  box(receiverWindow,0,0);
+  int lines, cols;
+  getmaxyx(receiverWindow,lines,cols);
+  const char* title = " Receivers ";
+  wmove(receiverWindow,0,cols/2-strlen(title)/2);
+  wattron(receiverWindow,A_BOLD);
+  wprintw(receiverWindow,title);
+  wattroff(receiverWindow,A_BOLD);
+
+  string report = receiverReport();
+  int row = 0;
+  string::size_type start = 0;
+  while(start < report.size() and row - receiverPanelOffset < lines - 2){
+    string::size_type end = report.find('\n', start);
+    if(end == string::npos){
+      end = report.size();
+    }
+    if(row >= receiverPanelOffset){
+      string line = report.substr(start, std::min<string::size_type>(end - start, cols - 4));
+      wmove(receiverWindow,row - receiverPanelOffset + 1,2);
+      wprintw(receiverWindow,"%s",line.c_str());
+    }
+    ++row;
+    start = end + 1;
+  }
+  wnoutrefresh(receiverWindow);
+}
+
+void showReceivers(){
+  receiverPanelOffset = 0;
+  isShowReceivers = true;
+  show_panel(receiverPanel);
+  hide_panel(mainPanel);
+  setStatus(STATUS_INFO_RECEIVERS);
+  renderReceiverPanel();
+  update_panels();
+}
+
+void hideReceivers(){
+  show_panel(mainPanel);
+  hide_panel(receiverPanel);
+  isShowReceivers = false;
+
+  updateStatusList(mainWindow);
+  setStatus(STATUS_INFO_KEYS);
+  update_panels();
+}
+
+/*
+ * Redraws the receiver panel with fresh counters if it is showing.
+ */
+void refreshReceivers(){
+  if(isShowReceivers and not disp){
+    renderReceiverPanel();
+    update_panels();
+    frameDrawn = true;
+  }
+}
+
+void handleReceiverInput(int userKey){
+  switch(userKey){
+    case 27:  // ESC or ALT key
+      userKey = getch();
+      if(userKey == ERR){ // ESC key
+        hideReceivers();
+      }
+      break;
+    case 'u':
+    case 'U':
+      hideReceivers();
+      break;
+    case KEY_HOME:
+      receiverPanelOffset = 0;
+      refreshReceivers();
+      break;
+    case KEY_UP:
+      if(receiverPanelOffset > 0){
+        --receiverPanelOffset;
+        refreshReceivers();
+      }
+      break;
+    case KEY_DOWN:
+      ++receiverPanelOffset;
+      refreshReceivers();
+      break;
+    case 'd':
+    case 'D':
+      setStatus(saveReceiverReport());
+      break;
+  }
+}
+
+/*
+ * Draws the tag's row if it is on screen, without updating the terminal.
+ * Returns true if the row was drawn.
+ */
+static bool drawStatusLine(WINDOW* win,int tagId){
+  int row = tagRow(tags,tagId);
+  if(row >= 0 and row >= displayBounds.first and row <= displayBounds.second){
+    wmove(win,getMinRow(win)+row-displayBounds.first,0);
+    printStatusLine(win,findTag(tags,tagId),tagId == mainHighlightId);
+    return true;
+  }
+  return false;
+}
+
+/*
+ * Draws the rows from first to last of the main list that are on screen,
+ * clearing those past the last tag, without updating the terminal.
+ */
+static void drawStatusRows(WINDOW* win,int first,int last){
+  int numIds = tagCount(tags);
+  int row = std::max(0,std::max(first,displayBounds.first));
+  for(; row <= last and row <= displayBounds.second; ++row){
+    wmove(win,row-displayBounds.first+getMinRow(win),0);
+    if(row < numIds){
+      int slot = slotAtRow(tags,row);
+      printStatusLine(win,slot,tags.samples[slot].tagID == mainHighlightId);
+    }else {
+      wclrtoeol(win);
+    }
+  }
+  wnoutrefresh(win);
+}
+
+/*
+ * Shows the main list after its bounds moved from oldBounds.  The rows still
+ * on screen are moved by scrolling the window and only the rows that came
+ * into view are drawn.  The terminal is not updated.
+ */
+static void scrollStatusList(WINDOW* win,pair<int,int> oldBounds){
+  if(panel_hidden(mainPanel)){
+    return;
+  }
+  int shift = displayBounds.first - oldBounds.first;
+  int height = displayBounds.second - displayBounds.first + 1;
+  // Resized, or nothing on screen is still in view
+  if(oldBounds.second - oldBounds.first != height - 1 or std::abs(shift) >= height){
+    updateStatusList(win);
+    return;
+  }
+  if(0 == shift){
+    return;
+  }
+  wsetscrreg(win,getMinRow(win),getMinRow(win)+height-1);
+  scrollok(win,TRUE);
+  wscrl(win,shift);
+  scrollok(win,FALSE);
+
+  int first = shift > 0 ? displayBounds.second - shift + 1 : displayBounds.first;
+  drawStatusRows(win,first,first + std::abs(shift) - 1);
+}
+
+/*
+ * Moves the highlight to a row of the main list, scrolling the list to it.
+ * The terminal is updated once all waiting keys are handled.
+ */
+static void highlightRow(int row){
+  int oldId = mainHighlightId;
+  pair<int,int> oldBounds = displayBounds;
+  mainHighlightId = tagAtRow(tags,row);
+  if(updateWindowBounds()){
+    scrollStatusList(mainWindow,oldBounds);
+  }
+  if(panel_hidden(mainPanel)){
+    return;
+  }
+  drawFraming(mainWindow);
+  if(oldId >= 0){
+    drawStatusLine(mainWindow,oldId);
+  }
+  drawStatusLine(mainWindow,mainHighlightId);
+}
+
 void handleMainInput(int userKey){
   int step = 0;
   switch(userKey){
@@ -561,19 +855,13 @@ void handleMainInput(int userKey){
       }
       break;
     case KEY_HOME:
-      if(not latestSample.empty()){
-        mainHighlightId = latestSample.begin()->first;
-        updateWindowBounds();
-        updateStatusList(mainWindow);
+      if(tagCount(tags) > 0){
+        highlightRow(0);
       }
       break;
     case KEY_END:
-      if(not latestSample.empty()){
-        map<int,pip_sample_t>::iterator it = latestSample.end();
-        it--;
-        mainHighlightId = it->first;
-        updateWindowBounds();
-        updateStatusList(mainWindow);
+      if(tagCount(tags) > 0){
+        highlightRow(tagCount(tags)-1);
       }
       break;
     case KEY_UP:
@@ -604,6 +892,26 @@ void handleMainInput(int userKey){
       setStatus(showHexIds ? "Changed to hex mode." : "Changed to decimal mode.");
       updateStatusList(mainWindow);
       break;
+    case 'o':
+    case 'O':
+      {
+        static const char* sortNames[SORT_ORDERS] = {"tag ID", "RSSI, weakest first",
+          "last packet, longest silent first", "battery, lowest first",
+          "temperature, hottest first", "period, shortest first",
+          "period confidence, lowest first"};
+        sortTags(tags,(tags.sort + 1) % SORT_ORDERS);
+        std::string message = std::string("Sorted by ") + sortNames[tags.sort] + ".";
+        setStatus(message);
+        // The highlighted tag stays highlighted wherever it is now listed
+        updateWindowBounds();
+        updateStatusList(mainWindow);
+      }
+      break;
+    case 'u':
+    case 'U':
+      showReceivers();
+      setStatus(usbSummary());
+      break;
    case KEY_BACKSPACE:
    case KEY_DL:
    case KEY_DC:
@@ -615,37 +923,11 @@ void handleMainInput(int userKey){
       break;
   }
   if(step){
-    if(mainHighlightId == -1 && latestSample.size() > 0){
-      mainHighlightId = latestSample.begin()->first;
-      updateStatusLine(mainWindow,mainHighlightId);
-    }else {
-      map<int,pip_sample_t>::iterator currIt = latestSample.find(mainHighlightId);
-      int oldId = currIt->first;
-      // Move up the list
-      if(step < 0 and currIt != latestSample.begin()){
-        while(step < 0 and currIt != latestSample.begin()){
-          currIt--;
-          ++step;
-        }
-        mainHighlightId = currIt->first;
-      }
-      // Move down the list
-      else {
-        map<int,pip_sample_t>::iterator stopIt = latestSample.end();
-        stopIt--;
-        while(step > 0 and currIt != stopIt){
-          currIt++;
-          --step;
-        }
-        mainHighlightId = currIt->first;
-      }
-      // Update display
-      if(updateWindowBounds()){
-        updateStatusList(mainWindow);
-      }else {
-        updateStatusLine(mainWindow,oldId);
-        updateStatusLine(mainWindow,currIt->first);
-      }
+    if(mainHighlightId == -1 && tagCount(tags) > 0){
+      highlightRow(0);
+    }else if(mainHighlightId != -1){
+      // Move up or down the list, stopping at either end
+      highlightRow(std::max(0,std::min(tagCount(tags)-1,tagRow(tags,mainHighlightId)+step)));
     }
   }
 
@@ -662,103 +944,50 @@ void updateHighlight(int userKey){
   }
   if(isShowHistory){
     handleHistoryInput(userKey);
+  }else if(isShowReceivers){
+    handleReceiverInput(userKey);
   }else {
     handleMainInput(userKey);
   }
 }
 
-void printStatusLine(WINDOW* win,pip_sample_t pkt, bool highlight){
+/*
+ * Draws the row of the tag in slot at the cursor in one write, from the
+ * formatted row cache.
+ */
+void printStatusLine(WINDOW* win,int slot, bool highlight){
   if(disp){
     return;
   }
-    wclrtoeol(win);
-
-      if(recordedIds.count(pkt.tagID)){
-        wprintw(win,"R ");
-      }else {
-        wprintw(win,"  ");
-      }
-      if(highlight){
-        wattron(win,A_REVERSE);
-        wattron(win,A_BOLD);
-      }
-
-
-      wprintw(win,(showHexIds ? "%04x  " : "%04d  "),pkt.tagID);
-      int color = COLOR_RSSI_MED;
-      if(pkt.rssi < -90.0){
-        color = COLOR_RSSI_LOW;
-      }else if(pkt.rssi > -60.0){
-        color = COLOR_RSSI_HIGH;
-      }
-      wattron(win,COLOR_PAIR(color));
-      wprintw(win,"%4.1f",pkt.rssi);
-      wattroff(win,COLOR_PAIR(color));
-
-      if(pkt.tempC > -300){
-        wprintw(win," %6.2f C",pkt.tempC);
-      }else{
-        wprintw(win," ------  ");
-      }
-      if(pkt.rh > -300){
-        wprintw(win," %6.2f %% ",pkt.rh);
-      }else {
-        wprintw(win," ------   ");
-      }
-      if(pkt.light >= 0){
-        color = COLOR_LIGHT_MED;
-        if(pkt.light < 0x40){
-          color = COLOR_LIGHT_LOW;
-        }else if(pkt.light > 0xB0){
-          color = COLOR_LIGHT_HIGH;
-        }
-        wattron(win,COLOR_PAIR(color));
-        wprintw(win,"%02x",pkt.light);
-        wattroff(win,COLOR_PAIR(color));
-      }else {
-        wprintw(win,"--");
-      }
-
-      if(pkt.moisture >= 0){
-        wprintw(win," %4d",(int)pkt.moisture);
-      }else {
-        wprintw(win," ----");
-      }
-
-      // Battery
-      wprintw(win,"  ");
-      if(pkt.batteryMv > 0){
-        color = 0; // default color
-        if(pkt.batteryMv >2.9){
-          color = COLOR_BATTERY_NORMAL;
-        }else if(pkt.batteryMv > 0){
-          color = COLOR_BATTERY_LOW;
-        }
-        wattron(win,COLOR_PAIR(color));
-        wprintw(win,"%4.3f",pkt.batteryMv);
-        wattroff(win,COLOR_PAIR(color));
-        wprintw(win," ");
-        wattron(win,COLOR_PAIR(color));
-        wprintw(win,"%4d",pkt.batteryJ);
-        wattroff(win,COLOR_PAIR(color));
-      }else {
-        wprintw(win,"----- ----");
-      }
-
-      //2014-12-02 13:34:04
-      char buffer[20];
-      strftime(buffer,20,DATE_TIME_FORMAT,std::localtime(&pkt.time.tv_sec));
-      wprintw(win,"  %s  ",buffer);
-
-      // Interval
-      color = pkt.intervalConfidence > 0.5 ? (pkt.intervalConfidence > 0.95 ? COLOR_CONFIDENCE_HIGH : COLOR_CONFIDENCE_MED) : COLOR_CONFIDENCE_LOW;
-      wattron(win,COLOR_PAIR(color));
-      wprintw(win,"%6d",pkt.interval);
-      wattroff(win,COLOR_PAIR(color));
-      wattroff(win,A_BOLD);
-      wattroff(win,A_REVERSE);
-
-      wnoutrefresh(win);
+  const pip_sample_t& pkt = tags.samples[slot];
+  const tag_row_t& row = formattedRow(rowCache,slot,pkt);
+  chtype line[2 + ROW_ID_WIDTH + ROW_WIDTH];
+  int length = 0;
+  const char* mark = recordedIds.count(pkt.tagID) ? "R " : "  ";
+  for(const char* c = mark; *c; ++c){
+    line[length++] = (unsigned char)*c;
+  }
+  attr_t attributes = highlight ? (A_REVERSE | A_BOLD) : A_NORMAL;
+  for(const char* c = showHexIds ? row.hexID : row.decimalID; *c; ++c){
+    line[length++] = (unsigned char)*c | attributes;
+  }
+  int span = 0;
+  for(int i = 0; i < row.length; ++i){
+    while(span < row.numSpans and i >= row.spans[span].end){
+      ++span;
+    }
+    attr_t color = (span < row.numSpans and i >= row.spans[span].start) ?
+      COLOR_PAIR(row.spans[span].color) : 0;
+    line[length++] = (unsigned char)row.text[i] | attributes | color;
+  }
+  // The rest of the line is cleared without moving the cursor
+  int y, x;
+  getyx(win,y,x);
+  wmove(win,y,x+length);
+  wclrtoeol(win);
+  wmove(win,y,x);
+  waddchnstr(win,line,length);
+  wnoutrefresh(win);
 }
 
 /*
@@ -794,13 +1023,13 @@ int getMinRow(WINDOW* win){
 }
 
 /*
- * Returns the index (into latestSample) of the highlighted tag, or -1 if none is highlighted.
+ * Returns the row of the highlighted tag, or -1 if none is highlighted.
  */
 int getMainHighlightIndex(){
   if(mainHighlightId < 0){
     return -1;
   }
-  return std::distance(latestSample.begin(),latestSample.find(mainHighlightId));
+  return tagRow(tags,mainHighlightId);
 }
 
 /*
@@ -816,7 +1045,7 @@ bool updateWindowBounds(){
   bool boundsChanged = false;
   // Need to shrink the window size 
   if(currWindowSize > maxRows){
-    displayBounds.second = latestSample.size();
+    displayBounds.second = tagCount(tags);
     displayBounds.first = displayBounds.second - maxRows;
     if(displayBounds.first < 0){
       displayBounds.first = 0;
@@ -950,7 +1179,6 @@ void draw(){
   // Replace with shuffled char
   waddch(win,s);
   wnoutrefresh(win);
-  repaint();
 }
 
 void setDispOff(){
@@ -958,11 +1186,13 @@ void setDispOff(){
   if(isShowHistory){
     renderHistoryPanel();
     setStatus(STATUS_INFO_HISTORY);
+  }else if(isShowReceivers){
+    renderReceiverPanel();
+    setStatus(STATUS_INFO_RECEIVERS);
   }else {
     updateStatusList(mainWindow);
     setStatus(STATUS_INFO_KEYS);
   }
-  repaint();
 
 }
 
@@ -972,11 +1202,13 @@ void setDisp(bool newVal){
     if(isShowHistory){
       renderHistoryPanel();
       setStatus(STATUS_INFO_HISTORY);
+    }else if(isShowReceivers){
+      renderReceiverPanel();
+      setStatus(STATUS_INFO_RECEIVERS);
     }else {
       updateStatusList(mainWindow);
       setStatus(STATUS_INFO_KEYS);
     }
-    repaint();
   }else {
     ssMode = (std::rand() % 2);
     r = 0;
@@ -987,50 +1219,98 @@ void setDisp(bool newVal){
 void updateStatusLine(WINDOW* win,int tagId){
   if(!panel_hidden(mainPanel)){
     drawFraming(win);
-    map<int,pip_sample_t>::iterator it = latestSample.find(tagId);
-    int row = std::distance(latestSample.begin(),it);
-    if(row >= displayBounds.first and row <= displayBounds.second){
-      wmove(win,getMinRow(win)+row-displayBounds.first,0);
-      pip_sample_t pkt = latestSample.find(tagId)->second;
-      printStatusLine(win,pkt,pkt.tagID == mainHighlightId);
-      repaint();
-    }
+    drawStatusLine(win,tagId);
   }
 
 
 }
 
-void saveHistory(std::list<pip_sample_t>& list){
-  if(list.empty()){
-    return;
+/*
+ * Formats sd as one line of a record file, without the newline, into buff
+ * of size bytes.  Returns the length of the line.
+ */
+static int formatRecord(const pip_sample_t& sd, char* buff, int size){
+  char tbuff[24]; // Date + time
+  strftime(tbuff,23,RECORD_FILE_TIME_FORMAT,std::localtime(&sd.time.tv_sec));
+  --size;
+
+  int length = snprintf(buff,size,RECORD_FILE_LINE_FORMAT,sd.time.tv_sec,sd.time.tv_usec/1000,tbuff,sd.tagID,sd.tagID,sd.rssi);
+  if(sd.tempC > -299){
+    length += snprintf(buff+length,size-length,RECORD_FILE_LINE_FORMAT_F4,sd.tempC);
+  }
+  length += snprintf(buff+length,size-length,",");
+
+  if(sd.rh > -299){
+    length += snprintf(buff+length,size-length,RECORD_FILE_LINE_FORMAT_F4,sd.rh);
+  }
+  length += snprintf(buff+length,size-length,",");
+
+  if(sd.light >= 0){
+    length += snprintf(buff+length,size-length,RECORD_FILE_LINE_FORMAT_F3,sd.light/255.0);
+  }
+  length += snprintf(buff+length,size-length,",");
+
+  if(sd.moisture >= 0){
+    length += snprintf(buff+length,size-length,"%ld",sd.moisture);
+  }
+  length += snprintf(buff+length,size-length,",");
+
+  if(sd.batteryMv >=0){
+    length += snprintf(buff+length,size-length,RECORD_FILE_LINE_FORMAT_F3,sd.batteryMv);
+  }
+  length += snprintf(buff+length,size-length,",");
+
+  if(sd.batteryJ >= 0){
+    length += snprintf(buff+length,size-length,"%d",sd.batteryJ);
+  }
+  return length;
+}
+
+/*
+ * Copies the history of the tag in slot into a snapshot file image,
+ * decoding the archived rows a block at a time.  Returns the name of the
+ * file, or an empty name if the tag has no history.
+ */
+static std::string snapshotImage(int slot,unsigned long newest,std::vector<unsigned char>& image){
+  int rows = historyRows(slot,newest);
+  if(0 == rows){
+    return std::string();
   }
   char filename[250];
   time_t tval;
   std::time(&tval);
   int offset = snprintf(filename,249,"snap-");
-  offset += snprintf(filename+offset,249-offset,"%04d-",list.front().tagID);
+  offset += snprintf(filename+offset,249-offset,"%04d-",tags.samples[slot].tagID);
   offset += strftime(filename+offset,249-offset,RECORD_FILE_FORMAT,std::localtime(&tval));
-  char buffer[80];
-  std::ofstream snapFile;
-  snapFile.open(filename);
-  if(!snapFile){
-    setStatus("Unable to save snapshot file.");
-    return;
-  }
-  snapFile << "Timestamp,Date,Tag ID,Tag ID (Hex),RSSI, Temp (C),Relative Humidity (%),Light (%),Moisture,Battery (mV),Battery (J)" << std::endl;
 
-  {
-    std::list<pip_sample_t>::iterator it = list.begin();
-    for(; it != list.end(); it++){
-      recordSample(*it,snapFile);
-    }
+  static const char header[] = "Timestamp,Date,Tag ID,Tag ID (Hex),RSSI, Temp (C),Relative Humidity (%),Light (%),Moisture,Battery (mV),Battery (J)\n";
+  image.assign(header,header+sizeof(header)-1);
+  char buff[255];
+  for(int row = 0; row < rows; ++row){
+    pip_sample_t sample = historyRow(slot,newest,row);
+    int length = formatRecord(sample,buff,sizeof(buff));
+    buff[length++] = '\n';
+    image.insert(image.end(),buff,buff+length);
   }
+  return filename;
+}
 
-  snapFile.close();
-
-  snprintf(buffer,79,"Saved history to \"%s\".",filename);
+/*
+ * Writes every row of the history panel to a snapshot file.
+ */
+void saveHistory(){
+  std::vector<unsigned char> image;
+  std::string filename = snapshotImage(historySlot,historyNewest,image);
+  if(filename.empty()){
+    return;
+  }
+  if(not writeFile(filename,image)){
+    setStatus("Unable to save snapshot file.");
+    return;
+  }
+  char buffer[80];
+  snprintf(buffer,79,"Saved history to \"%s\".",filename.c_str());
   setStatus(buffer);
-
 }
 
 void recordSample(pip_sample_t& sd){
@@ -1040,49 +1320,20 @@ void recordSample(pip_sample_t& sd){
 void recordSample(pip_sample_t& sd, std::ofstream& file){
   if(file){
     char buff[255];
-    char tbuff[24]; // Date + time
-    strftime(tbuff,23,RECORD_FILE_TIME_FORMAT,std::localtime(&sd.time.tv_sec));
-    
-    int length = snprintf(buff,254,RECORD_FILE_LINE_FORMAT,sd.time.tv_sec,sd.time.tv_usec/1000,tbuff,sd.tagID,sd.tagID,sd.rssi);
-    if(sd.tempC > -299){
-      length += snprintf(buff+length,254-length,RECORD_FILE_LINE_FORMAT_F4,sd.tempC);
-    }
-    length += snprintf(buff+length,254-length,",");
-
-    if(sd.rh > -299){
-      length += snprintf(buff+length,254-length,RECORD_FILE_LINE_FORMAT_F4,sd.rh);
-    }
-    length += snprintf(buff+length,254-length,",");
-
-    if(sd.light >= 0){
-      length += snprintf(buff+length,254-length,RECORD_FILE_LINE_FORMAT_F3,sd.light/255.0);
-    }
-    length += snprintf(buff+length,254-length,",");
-
-    if(sd.moisture >= 0){
-      length += snprintf(buff+length,254-length,"%ld",sd.moisture);
-    }
-    length += snprintf(buff+length,254-length,",");
-
-    if(sd.batteryMv >=0){
-      length += snprintf(buff+length,254-length,RECORD_FILE_LINE_FORMAT_F3,sd.batteryMv);
-    }
-    length += snprintf(buff+length,254-length,",");
-
-    if(sd.batteryJ >= 0){
-      length += snprintf(buff+length,254-length,"%d",sd.batteryJ);
-    }
-  
+    int length = formatRecord(sd,buff,sizeof(buff));
     if(!(file << std::string(buff,length) << std::endl)){
       setStatus((char*)"Error writing to record file!");
     }
   }
-
 }
 
-void updateState(pip_sample_t& sd){
-  int prevLength = latestSample.size();
-  pip_sample_t& storedData = latestSample[sd.tagID];
+/*
+ * Folds one sample into the latest values, history and recording of its tag.
+ */
+static void storeSample(pip_sample_t& sd){
+  int slot = insertTag(tags,sd.tagID);
+  agingBeforeUpdate(aging,tags,slot);
+  pip_sample_t& storedData = tags.samples[slot];
   unsigned long int oldTime = (storedData.time.tv_sec*1000 + storedData.time.tv_usec/1000);
   storedData.time = sd.time;
   storedData.tagID = sd.tagID;
@@ -1103,11 +1354,8 @@ void updateState(pip_sample_t& sd){
     storedData.batteryJ = -1;
   }
 
-  list<pip_sample_t>& tagHistory = history[sd.tagID];
-  tagHistory.push_front(sd);
-  if(tagHistory.size() > MAX_HISTORY){
-    tagHistory.pop_back();
-  }
+  appendHistory(history,slot,sd);
+  archiveSample(archive,slot,sd);
 
   // Update interval and confidence metric
   if(storedData.interval == 0){
@@ -1132,41 +1380,290 @@ void updateState(pip_sample_t& sd){
     }
     storedData.interval += (intAdj*(1-(storedData.intervalConfidence*.9)));
   }
+  // A tag that moved shifts every row between its old and new rows
+  int oldRow = tagAfterUpdate(tags,slot);
+  if(0 <= oldRow){
+    int newRow = tagRow(tags,sd.tagID);
+    if(frameLast < frameFirst){
+      frameFirst = frameLast = oldRow;
+    }
+    frameFirst = std::min(frameFirst,std::min(oldRow,newRow));
+    frameLast = std::max(frameLast,std::max(oldRow,newRow));
+  }
+  agingAfterUpdate(aging,tags,slot);
+  invalidateRow(rowCache,slot);
 
   std::set<int>::iterator it = recordedIds.find(sd.tagID);
   if(it != recordedIds.end()){
     recordSample(sd);
   }
-  if(sd.dropped > 0){
-    char buff[20];
-    snprintf(buff,19,"Dropped: %3d",sd.dropped);
+}
+
+void updateState(pip_sample_t& sd){
+  updateStates(&sd,1);
+}
+
+/*
+ * Sets how long silent tags are kept, in periods of the tag (0 keeps them),
+ * whether their history is saved when they expire, and the memory (MB) all
+ * history may take (0 for no limit).
+ */
+void setTagAging(double expirePeriods,bool saveExpired,size_t memoryMB){
+  initAging(aging,expirePeriods,saveExpired,memoryMB << 20);
+}
+
+/*
+ * Carries on with the tags and history saved in path by an earlier run, if
+ * there is such a file.  A file that cannot be used is replaced by the next
+ * checkpoint.
+ */
+void loadConsoleState(const std::string& path){
+  int result = loadState(path,tags,history,archive,aging);
+  char buff[160];
+  if(STATE_LOADED == result){
+    clearRows(rowCache);
+    snprintf(buff,159,"Restored %d tags from \"%s\".",tagCount(tags),path.c_str());
+    updateWindowBounds();
+    updateStatusList(mainWindow);
+  }else if(STATE_INCOMPATIBLE == result){
+    snprintf(buff,159,"State in \"%s\" is from another version, starting empty.",path.c_str());
+  }else if(STATE_DAMAGED == result){
+    snprintf(buff,159,"Unable to read state from \"%s\", starting empty.",path.c_str());
+  }else {
+    return;
+  }
+  setStatus(buff);
+}
+
+/*
+ * Checkpoints the tags and history to path for the next run.  Returns false
+ * if they could not be saved.
+ */
+bool saveConsoleState(const std::string& path){
+  return saveState(path,tags,history,archive,aging);
+}
+
+/*
+ * Starts checkpointing the tags and history to path in the background,
+ * unless the last checkpoint to path is still being written.  Only the
+ * copy of the state is made here.
+ */
+void startConsoleCheckpoint(const std::string& path){
+  checkpointPath = path;
+  if(writePending(writer,path)){
+    return;
+  }
+  std::vector<unsigned char> image;
+  stateImage(tags,history,archive,aging,image);
+  queueWrite(writer,path,image);
+}
+
+/*
+ * Collects the files written in the background, with wait once all of
+ * them are written.  Snapshots that could not be written are shown on the
+ * status line.  Returns false if a checkpoint could not be written.
+ */
+bool finishConsoleWrites(bool wait){
+  std::vector<std::string> failed;
+  finishWrites(writer,wait,failed);
+  bool saved = true;
+  for(size_t i = 0; i < failed.size(); ++i){
+    if(failed[i] == checkpointPath){
+      saved = false;
+    }
+    else {
+      char buffer[80];
+      snprintf(buffer,79,"Unable to save snapshot file \"%s\".",failed[i].c_str());
+      setStatus(buffer);
+    }
+  }
+  return saved;
+}
+
+/*
+ * Expires tags that have been silent too long, then drops the history of
+ * the least recently heard tags while history takes more than its memory
+ * cap.  At most AGING_BUDGET tags are handled per batch and the rest in the
+ * batches after it.  Returns true if any tag was removed.
+ */
+static bool ageTags(){
+  int budget = AGING_BUDGET;
+  int expired = 0;
+  int held = 0;
+  int slot;
+  while(0 < budget and 0 != (slot = expiredTag(aging,held))){
+    // The tag in the history panel waits until the panel is closed
+    if(isShowHistory and slot == historySlot){
+      ++held;
+      continue;
+    }
+    // Its history is copied here and written by the writer thread
+    if(aging.saveExpired){
+      std::vector<unsigned char> image;
+      std::string filename = snapshotImage(slot,historyTotal(history,slot),image);
+      if(not filename.empty()){
+        queueWrite(writer,filename,image);
+      }
+    }
+    removeSensor(tags.samples[slot].tagID);
+    ++aging.expired;
+    ++expired;
+    --budget;
+  }
+
+  int evicted = 0;
+  slot = leastRecentTag(aging,0);
+  while(0 < budget and 0 != slot and 0 < aging.memoryCap and
+      historyBytes(history) + archive.bytes > aging.memoryCap){
+    int next = leastRecentTag(aging,slot);
+    if(not (isShowHistory and slot == historySlot)){
+      clearHistory(history,slot);
+      clearArchive(archive,slot);
+      agingUnlist(aging,slot);
+      ++aging.evicted;
+      ++evicted;
+      --budget;
+    }
+    slot = next;
+  }
+
+  if(expired > 0 or evicted > 0){
+    char buff[80];
+    if(evicted == 0){
+      snprintf(buff,79,"Expired %d silent tags (%lu in all).",expired,aging.expired);
+    }else {
+      snprintf(buff,79,"Dropped the history of %d tags to stay under %lu MB.",
+          evicted,(unsigned long)(aging.memoryCap >> 20));
+    }
     setStatus(buff);
   }
+  return expired > 0;
+}
 
-  renderUpdate(sd.tagID,prevLength != latestSample.size());
-  timeval t;
-  gettimeofday(&t,NULL);
-  if(t.tv_sec - lastKey.tv_sec > FUN_START_DELAY){
-    if(!disp){
-      setDisp(true);
+/*
+ * Ages the tags by the time passed while no samples arrived, so that tags
+ * expire even when every receiver has gone quiet.  Called every second.
+ */
+void ageConsole(){
+  timespec clock;
+  clock_gettime(CLOCK_MONOTONIC,&clock);
+  agingTick(aging,(int64_t)clock.tv_sec*1000 + clock.tv_nsec/1000000);
+  if(ageTags()){
+    frameList = true;
+    frameIds.clear();
+    framePending = true;
+  }
+}
+
+/*
+ * Folds a batch of samples into the console state.  Nothing is drawn, the
+ * rows that changed are drawn by the next frame.
+ */
+void updateStates(pip_sample_t* samples, size_t count){
+  if(0 == count){
+    return;
+  }
+  int prevLength = tagCount(tags);
+  for(size_t i = 0; i < count; ++i){
+    storeSample(samples[i]);
+    frameDropped += samples[i].dropped;
+    if(not frameList){
+      frameIds.insert(samples[i].tagID);
     }
-    screenSaver(sd);
   }
+  if(ageTags() or prevLength != tagCount(tags)){
+    //Rows came or went, every row on screen is drawn again
+    frameList = true;
+    frameIds.clear();
+  }
+  if(isShowHistory and followHistory()){
+    frameHistory = true;
+  }
+  frameSample = samples[count-1];
+  framePending = true;
 }
 
-/**
- * Handles screen updates after a data update
+/*
+ * Sets the most frames per second drawn for new samples.
  */
-void renderUpdate(int updatedId,bool newEntry){
-  updateWindowBounds();
+void setFrameRate(int fps){
+  frameInterval = 1000 / fps;
+}
+
+/*
+ * Milliseconds until the next frame should be drawn, 0 if it is due, or -1
+ * if nothing has changed since the last frame.
+ */
+int frameWait(){
+  if(not framePending and not frameDrawn){
+    return -1;
+  }
+  timeval now;
+  gettimeofday(&now,NULL);
+  long elapsed = (now.tv_sec - lastFrame.tv_sec)*1000 + (now.tv_usec - lastFrame.tv_usec)/1000;
+  //A clock set back also makes the frame due
+  if(elapsed < 0 or elapsed >= frameInterval){
+    return 0;
+  }
+  return frameInterval - elapsed;
+}
+
+/*
+ * Draws what the samples since the last frame changed and updates the
+ * terminal once for all of it.  Keys do not wait for frames, what their
+ * handlers draw is shown once every waiting key is handled.
+ */
+void renderFrame(){
+  gettimeofday(&lastFrame,NULL);
+  if(not framePending){
+    // Only windows drawn outside a frame changed
+    if(frameDrawn){
+      frameDrawn = false;
+      repaint();
+    }
+    return;
+  }
+  framePending = false;
+  if(frameDropped > 0){
+    char buff[20];
+    snprintf(buff,19,"Dropped: %3d",frameDropped);
+    setStatus(buff);
+    frameDropped = 0;
+  }
+
+  if(isShowHistory and frameHistory){
+    renderHistoryPanel();
+  }
+  frameHistory = false;
+
+  // Following the highlighted tag can move every row on screen
+  if(updateWindowBounds()){
+    frameList = true;
+  }
   if(!panel_hidden(mainPanel)){
-    if(newEntry){
+    if(frameList){
       updateStatusList(mainWindow);
     }else {
-      updateStatusLine(mainWindow,updatedId);
+      drawFraming(mainWindow);
+      drawStatusRows(mainWindow,frameFirst,frameLast);
+      for(std::set<int>::iterator it = frameIds.begin(); it != frameIds.end(); ++it){
+        drawStatusLine(mainWindow,*it);
+      }
     }
   }
+  frameList = false;
+  frameIds.clear();
+  frameFirst = 0;
+  frameLast = -1;
 
+  if(lastFrame.tv_sec - lastKey.tv_sec > FUN_START_DELAY){
+    if(!disp){
+      setDisp(true);
+    }
+    screenSaver(frameSample);
+  }
+  frameDrawn = false;
+  repaint();
 }
 
 void drawFraming(WINDOW* win){
@@ -1180,7 +1677,7 @@ void drawFraming(WINDOW* win){
   int maxx, maxy;
   getmaxyx(win,maxy,maxx);
   wmove(win,maxy-1,0);
-  int numIds = latestSample.size();
+  int numIds = tagCount(tags);
   wclrtoeol(win);
   waddch(win,(numIds > 0) and (displayBounds.second < (numIds-1)) ? ('v'|A_BOLD|COLOR_PAIR(COLOR_SCROLL_ARROW)) : ' ');
   wmove(win,0,1);
@@ -1195,25 +1692,8 @@ void updateStatusList(WINDOW* win){
     updateWindowBounds();
     drawFraming(win);
 
-    int row = 0;
-    map<int,pip_sample_t>::iterator pIter = latestSample.begin();
-    for(; pIter != latestSample.end(); ++pIter,++row){
-      if(row < displayBounds.first){
-        continue;
-      }else if(row > displayBounds.second){
-        break;
-      }
-      
-      pip_sample_t pkt = pIter->second;
-      wmove(win,row-displayBounds.first+getMinRow(win),0);
-      printStatusLine(win,pkt,pkt.tagID == mainHighlightId);
-    }
-    for(;row <= displayBounds.second; ++row){
-      wmove(win,row-displayBounds.first+getMinRow(win),0);
-      wclrtoeol(win);
-    }
-
-    repaint();
+    // Only the rows on screen are looked up
+    drawStatusRows(win,displayBounds.first,displayBounds.second);
   }
 }
 
@@ -1261,12 +1741,15 @@ void initNCurses(){
   mainWindow = newwin(maxY-1,maxX, 0, 0);// main window covers entire screen
   historyWindow = newwin(maxY-1, maxX, 0, 0); // history window covers entire screen
   statusWindow = newwin(1,maxX,maxY-1,0); // Status panel at the bottom, 1 line high
+  receiverWindow = newwin(maxY-1, maxX, 0, 0); // receiver window covers entire screen
 
   mainPanel = new_panel(mainWindow);
   historyPanel = new_panel(historyWindow);
   statusPanel = new_panel(statusWindow);
+  receiverPanel = new_panel(receiverWindow);
   box(historyWindow,0,0);
   hide_panel(historyPanel);
+  hide_panel(receiverPanel);
   // Update the stacking order of panels, history on top
   gettimeofday(&lastKey, NULL);
   
@@ -1282,16 +1765,27 @@ void resizePanels(){
   getmaxyx(stdscr,maxY,maxX);
   WINDOW* oldWin = mainWindow;
   mainWindow = newwin(maxY-1,maxX,0,0);
+  // Let the terminal scroll the list instead of redrawing it.  Scrolling
+  // itself is only enabled around wscrl, so that writing the last cell of
+  // the window does not scroll it.
+  idlok(mainWindow,TRUE);
   replace_panel(mainPanel,mainWindow);
   delwin(oldWin);
   update_panels();
 }
 
 
+/*
+ * Handles every key press that is waiting.  ncurses may buffer several keys
+ * from a single read of stdin, so keep going until getch() has nothing left.
+ */
 void ncursesUserInput(){
-  int userCh = getch();
-  if(userCh != ERR){
+  int userCh;
+  while((userCh = getch()) != ERR){
     updateHighlight(userCh);
   }
+  // Keys are answered at once, not at the next frame
+  frameDrawn = false;
+  repaint();
 }
 
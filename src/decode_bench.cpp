@@ -0,0 +1,179 @@
+/*
+ * Copyright (C) 2014 Robert S. Moore II and Rutgers University
+ * All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA
+ * or visit http://www.gnu.org/licenses/gpl-2.0.html
+ */
+
+/*******************************************************************************
+ * @file decode_bench.cpp
+ * Compares the generated sensor decoders against the original chain of
+ * header tests, on a mix of sensor headers like a deployment sends.  Built
+ * only with -DBUILD_BENCHMARKS=ON.
+ *
+ * decode_bench [frames]
+ *
+ * @author Robert S. Moore II
+ ******************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <random>
+#include <vector>
+
+#include <pip_sensor.hpp>
+#include <pip_usb.hpp>
+#include <pip_util.hpp>
+
+/* Frames decoded per run unless given on the command line */
+#define BENCH_FRAMES 1000000
+/* Times each decoder runs over the frames, the fastest run is reported */
+#define BENCH_RUNS 5
+
+/*
+ * The decoder as it was before the generated tables, kept for comparison.
+ */
+static void legacyDecode(const unsigned char* data, int length, pip_sample_t& s){
+  if(length == 0){
+    return;
+  }
+  unsigned char hdr = data[0];
+  int i = 1;
+  if(hdr & 0x01){
+    s.tempC = (data[i]>>1) - 40;
+    ++i;
+  }
+  if(hdr & 0x02){
+    s.tempC = ((data[i]<<4) + (data[i+1]/16.0));
+    i += 2;
+  }
+  if(hdr & 0x04){
+    s.light = data[i];
+    ++i;
+  }
+  if(hdr & 0x08){
+    s.tempC = ((data[i]<<4) + (data[i+1]/16.0));
+    i += 2;
+    s.rh = ((data[i]<<4) + (data[i+1]/16.0));
+    i += 2;
+  }
+  if(hdr & 0x10){
+    s.moisture = ((data[i]<<8) + (data[i+1]));
+    i += 2;
+  }
+  if(hdr & 0x20){
+    i += 6;
+  }
+  if(hdr & 0x40){
+    s.batteryMv = ((data[i]<<8) + (data[i+1]))/1000.0;
+    i += 2;
+    s.batteryJ = ((data[i]<<8) + (data[i+1]));
+    i += 2;
+  }
+}
+
+/*
+ * The decoders as types, so that each is inlined into its timing loop the
+ * way it is inlined where frames are decoded.
+ */
+struct LegacyDecoder {
+  static void decode(const unsigned char* data, int length, pip_sample_t& s){
+    legacyDecode(data, length, s);
+  }
+};
+
+struct GeneratedDecoder {
+  static void decode(const unsigned char* data, int length, pip_sample_t& s){
+    decodeSensorData(data, length, s);
+  }
+};
+
+typedef struct {
+  unsigned char data[PACKET_EXTRA_LEN];
+  int length;
+} bench_frame_t;
+
+/*
+ * Decodes every frame into a fresh sample and folds the values into a
+ * checksum, so both decoders can be seen to agree and neither is optimized
+ * away.  Returns the fastest run in nanoseconds per frame.
+ */
+template <typename Decoder>
+static double timeDecoder(const std::vector<bench_frame_t>& frames, double& checksum){
+  double best = -1;
+  for(int run = 0; run < BENCH_RUNS; ++run){
+    double sum = 0;
+    double start = nowMs();
+    for(size_t i = 0; i < frames.size(); ++i){
+      pip_sample_t s;
+      s.tempC = s.rh = s.batteryMv = -1;
+      s.light = s.batteryJ = -1;
+      s.moisture = -1;
+      Decoder::decode(frames[i].data, frames[i].length, s);
+      sum += s.tempC + s.rh + s.light + s.moisture + s.batteryMv + s.batteryJ;
+    }
+    double ns = (nowMs() - start) * 1e6 / frames.size();
+    if(best < 0 or ns < best){
+      best = ns;
+    }
+    checksum = sum;
+  }
+  return best;
+}
+
+int main(int argc, char** argv){
+  long count = BENCH_FRAMES;
+  if(1 < argc){
+    count = strtol(argv[1], NULL, 10);
+  }
+  if(0 >= count){
+    fprintf(stderr, "Usage: %s [frames]\n", argv[0]);
+    return 1;
+  }
+
+  //Mostly temperature/humidity tags with light and battery, some with less.
+  //0x6F is every block but moisture, 19 bytes.  All of them (0x7F) would
+  //take 21, more than the PACKET_EXTRA_LEN a packet can carry.
+  const unsigned char headers[] = {0x4C, 0x4C, 0x4C, 0x4C, 0x48, 0x48, 0x02, 0x51, 0x00, 0x6F};
+  std::mt19937 rng(42);
+  std::uniform_int_distribution<int> pick(0, sizeof(headers) - 1);
+  std::uniform_int_distribution<int> byte(0, 255);
+  std::vector<bench_frame_t> frames(count);
+  for(long i = 0; i < count; ++i){
+    bench_frame_t& f = frames[i];
+    unsigned char hdr = headers[pick(rng)];
+    f.length = 0 == hdr ? 0 : sensorDataLength(hdr);
+    f.data[0] = hdr;
+    for(int b = 1; b < PACKET_EXTRA_LEN; ++b){
+      f.data[b] = byte(rng);
+    }
+  }
+
+  double legacySum = 0;
+  double generatedSum = 0;
+  double legacy = timeDecoder<LegacyDecoder>(frames, legacySum);
+  double generated = timeDecoder<GeneratedDecoder>(frames, generatedSum);
+  printf("%ld frames, best of %d runs\n", count, BENCH_RUNS);
+  printf("legacy:    %6.2f ns/frame (checksum %.1f)\n", legacy, legacySum);
+  printf("generated: %6.2f ns/frame (checksum %.1f)\n", generated, generatedSum);
+  if(legacySum != generatedSum){
+    fprintf(stderr, "The decoders disagree\n");
+    return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,147 @@
+/*
+ * Copyright (C) 2014 Robert S. Moore II and Rutgers University
+ * All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA
+ * or visit http://www.gnu.org/licenses/gpl-2.0.html
+ */
+
+/*******************************************************************************
+ * @file pip_aging.cpp
+ * Expiry order and recency list of the tags.
+ *
+ * @author Robert S. Moore II
+ ******************************************************************************/
+
+#include <pip_aging.hpp>
+
+static int64_t sampleTime(const pip_sample_t& s){
+  return (int64_t)s.time.tv_sec * 1000 + s.time.tv_usec / 1000;
+}
+
+/*
+ * Sets the aging policy.  The expiry order keeps the deadline each tag had
+ * when it was last heard, so a new policy applies to a tag from its next
+ * sample on.
+ */
+void initAging(tag_aging_t& aging, double expirePeriods, bool saveExpired, size_t memoryCap){
+  aging.expirePeriods = expirePeriods;
+  aging.saveExpired = saveExpired;
+  aging.memoryCap = memoryCap;
+  aging.byDeadline.keyed = true;
+}
+
+/*
+ * Lists the tag in slot in the expiry order by its current sample.
+ */
+void agingSchedule(tag_aging_t& aging, const tag_table_t& table, int slot){
+  const pip_sample_t& sample = table.samples[slot];
+  if(0 < aging.expirePeriods){
+    orderInsertKey(aging.byDeadline, table.samples, slot,
+        sampleTime(sample) + aging.expirePeriods * sample.interval);
+  }
+}
+
+/*
+ * Takes the tag in slot out of the expiry order before its sample changes.
+ */
+void agingBeforeUpdate(tag_aging_t& aging, const tag_table_t& table, int slot){
+  if(0 < aging.expirePeriods){
+    orderErase(aging.byDeadline, table.samples, slot);
+  }
+}
+
+/*
+ * Puts the tag in slot back in the expiry order by its new sample and makes
+ * it the most recently heard.
+ */
+void agingAfterUpdate(tag_aging_t& aging, const tag_table_t& table, int slot){
+  const pip_sample_t& sample = table.samples[slot];
+  agingSchedule(aging, table, slot);
+  if(sampleTime(sample) > aging.now){
+    aging.now = sampleTime(sample);
+  }
+
+  if(aging.newer.size() <= (size_t)slot){
+    if(aging.newer.empty()){
+      //The empty list, slot 0 linked to itself
+      aging.newer.push_back(0);
+      aging.older.push_back(0);
+    }
+    aging.newer.resize(table.samples.size(), -1);
+    aging.older.resize(table.samples.size(), -1);
+  }
+  agingUnlist(aging, slot);
+  int newest = aging.older[0];
+  aging.older[slot] = newest;
+  aging.newer[slot] = 0;
+  aging.newer[newest] = slot;
+  aging.older[0] = slot;
+}
+
+/*
+ * Takes slot off the recency list, as when its history has been dropped.
+ */
+void agingUnlist(tag_aging_t& aging, int slot){
+  if(aging.newer.size() <= (size_t)slot or -1 == aging.newer[slot]){
+    return;
+  }
+  aging.newer[aging.older[slot]] = aging.newer[slot];
+  aging.older[aging.newer[slot]] = aging.older[slot];
+  aging.newer[slot] = aging.older[slot] = -1;
+}
+
+/*
+ * Forgets the tag in slot, which is about to be removed from the table.
+ */
+void agingForget(tag_aging_t& aging, const tag_table_t& table, int slot){
+  agingBeforeUpdate(aging, table, slot);
+  agingUnlist(aging, slot);
+}
+
+/*
+ * Called periodically with the monotonic clock (ms).  If no sample moved
+ * the time on since the last tick, the clock's time passes instead.
+ */
+void agingTick(tag_aging_t& aging, int64_t clock){
+  if(0 < aging.tickClock and aging.now == aging.tickNow){
+    aging.now += clock - aging.tickClock;
+  }
+  aging.tickNow = aging.now;
+  aging.tickClock = clock;
+}
+
+/*
+ * Returns the slot of a tag that has expired, passing over the first skip
+ * of them, or 0 if there is no such tag.
+ */
+int expiredTag(const tag_aging_t& aging, int skip){
+  if(0 >= aging.expirePeriods){
+    return 0;
+  }
+  int slot = orderSelect(aging.byDeadline, skip);
+  if(0 == slot or aging.byDeadline.nodes[slot].key > aging.now){
+    return 0;
+  }
+  return slot;
+}
+
+/*
+ * Returns the least recently heard tag with history after slot, or the
+ * least recently heard of all for slot 0.  Returns 0 past the end.
+ */
+int leastRecentTag(const tag_aging_t& aging, int slot){
+  return aging.newer.empty() ? 0 : aging.newer[slot];
+}
@@ -0,0 +1,452 @@
+/*
+ * Copyright (C) 2014 Robert S. Moore II and Rutgers University
+ * All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA
+ * or visit http://www.gnu.org/licenses/gpl-2.0.html
+ */
+
+/*******************************************************************************
+ * @file pip_archive.cpp
+ * Compressed, columnar long-term history of every tag.
+ *
+ * @author Robert S. Moore II
+ ******************************************************************************/
+
+#include <math.h>
+#include <string.h>
+
+#include <pip_archive.hpp>
+
+using std::vector;
+
+/*
+ * Appends value as a zigzag varint, returning the bytes written.
+ */
+static int putVarint(vector<unsigned char>& column, int64_t value){
+  uint64_t zigzag = ((uint64_t)value << 1) ^ (uint64_t)(value >> 63);
+  int written = 1;
+  while(zigzag >= 0x80){
+    column.push_back((zigzag & 0x7F) | 0x80);
+    zigzag >>= 7;
+    ++written;
+  }
+  column.push_back(zigzag);
+  return written;
+}
+
+/*
+ * Reads a zigzag varint that must end before end.  Returns false if it
+ * does not, or if it is longer than any putVarint writes.
+ */
+static bool getVarint(const unsigned char*& p, const unsigned char* end, int64_t& value){
+  uint64_t zigzag = 0;
+  for(int shift = 0; shift < 64; shift += 7){
+    if(p == end){
+      return false;
+    }
+    unsigned char byte = *p++;
+    zigzag |= (uint64_t)(byte & 0x7F) << shift;
+    if(0 == (byte & 0x80)){
+      value = (int64_t)(zigzag >> 1) ^ -(int64_t)(zigzag & 1);
+      return true;
+    }
+  }
+  return false;
+}
+
+/*
+ * Adds the next varint of a column to value.
+ */
+static bool addVarint(const unsigned char*& p, const unsigned char* end, int64_t& value){
+  int64_t delta;
+  if(not getVarint(p, end, delta)){
+    return false;
+  }
+  value += delta;
+  return true;
+}
+
+/*
+ * Writes value to its column as the difference from the one before it.
+ */
+static int putDelta(archive_tag_t& tag, int column, int64_t value){
+  int written = putVarint(tag.open[column], value - tag.state.value[column]);
+  tag.state.value[column] = value;
+  return written;
+}
+
+static int flushRun(archive_tag_t& tag){
+  if(0 == tag.runLength){
+    return 0;
+  }
+  int written = putVarint(tag.open[ARCHIVE_PRESENT], tag.runBits);
+  written += putVarint(tag.open[ARCHIVE_PRESENT], tag.runLength);
+  tag.runLength = 0;
+  return written;
+}
+
+/*
+ * Appends column to data with its runs of zero bytes shortened, or as it
+ * is if that is no larger.  An empty column stays empty.
+ */
+static void packColumn(const vector<unsigned char>& column, vector<unsigned char>& data){
+  if(column.empty()){
+    return;
+  }
+  size_t start = data.size();
+  data.push_back(ARCHIVE_ZERO_RUNS);
+  for(size_t i = 0; i < column.size();){
+    if(0 != column[i]){
+      data.push_back(column[i++]);
+      continue;
+    }
+    size_t run = 1;
+    while(run < 256 and i + run < column.size() and 0 == column[i + run]){
+      ++run;
+    }
+    data.push_back(0);
+    data.push_back(run - 1);
+    i += run;
+  }
+  if(data.size() - start >= 1 + column.size()){
+    data.resize(start);
+    data.push_back(ARCHIVE_RAW);
+    data.insert(data.end(), column.begin(), column.end());
+  }
+}
+
+/*
+ * Returns the encoded values of the sealed column from begin to end,
+ * expanding them into column if they were compressed, or NULL if the
+ * column is not one packColumn writes.
+ */
+static const unsigned char* unpackColumn(const unsigned char* begin, const unsigned char* end,
+    vector<unsigned char>& column, const unsigned char*& columnEnd){
+  if(begin == end or ARCHIVE_RAW == *begin){
+    columnEnd = end;
+    return begin == end ? end : begin + 1;
+  }
+  if(ARCHIVE_ZERO_RUNS != *begin){
+    return NULL;
+  }
+  column.clear();
+  for(const unsigned char* p = begin + 1; p < end; ++p){
+    if(0 != *p){
+      column.push_back(*p);
+    }
+    else if(++p < end){
+      column.insert(column.end(), (size_t)*p + 1, 0);
+    }
+    else {
+      return NULL;
+    }
+  }
+  columnEnd = column.data() + column.size();
+  return column.data();
+}
+
+/*
+ * Compresses the full open block of tag into one buffer and starts a new
+ * block.
+ */
+static void sealBlock(archive_t& archive, archive_tag_t& tag){
+  archive.bytes += flushRun(tag) + sizeof(archive_block_t);
+  tag.sealed.push_back(archive_block_t());
+  archive_block_t& block = tag.sealed.back();
+  block.firstTime = tag.openFirst;
+  size_t size = 0;
+  for(int c = 0; c < ARCHIVE_COLUMNS; ++c){
+    size += tag.open[c].size();
+  }
+  block.data.reserve(size + ARCHIVE_COLUMNS);
+  for(int c = 0; c < ARCHIVE_COLUMNS; ++c){
+    packColumn(tag.open[c], block.data);
+    block.end[c] = block.data.size();
+    //Keep the capacity, the next block will need about as much
+    tag.open[c].clear();
+  }
+  block.data.shrink_to_fit();
+  archive.bytes = archive.bytes - size + block.data.size();
+  tag.openCount = 0;
+}
+
+/*
+ * Adds a sample to the archive of the tag in slot.
+ */
+void archiveSample(archive_t& archive, int slot, const pip_sample_t& sample){
+  if(archive.tags.size() <= (size_t)slot){
+    archive.tags.resize(slot + 1);
+  }
+  archive_tag_t& tag = archive.tags[slot];
+  tag.tagID = sample.tagID;
+  int64_t time = (int64_t)sample.time.tv_sec * 1000 + sample.time.tv_usec / 1000;
+  if(0 == tag.openCount){
+    tag.openFirst = time;
+    memset(&tag.state, 0, sizeof(tag.state));
+    tag.state.time = time;
+  }
+
+  unsigned char bits = 0;
+  bits |= sample.tempC > -299 ? ARCHIVE_HAS_TEMP : 0;
+  bits |= sample.rh > -299 ? ARCHIVE_HAS_RH : 0;
+  bits |= sample.light >= 0 ? ARCHIVE_HAS_LIGHT : 0;
+  bits |= sample.moisture >= 0 ? ARCHIVE_HAS_MOISTURE : 0;
+  bits |= sample.batteryMv >= 0 ? ARCHIVE_HAS_BATTERY_MV : 0;
+  bits |= sample.batteryJ >= 0 ? ARCHIVE_HAS_BATTERY_J : 0;
+  size_t written = 0;
+  if(0 < tag.runLength and bits != tag.runBits){
+    written += flushRun(tag);
+  }
+  tag.runBits = bits;
+  ++tag.runLength;
+
+  int64_t interval = time - tag.state.time;
+  written += putVarint(tag.open[ARCHIVE_TIME], interval - tag.state.interval);
+  tag.state.interval = interval;
+  tag.state.time = time;
+  written += putDelta(tag, ARCHIVE_RSSI, lround(sample.rssi * 2));
+  if(bits & ARCHIVE_HAS_TEMP){
+    written += putDelta(tag, ARCHIVE_TEMP, lround(sample.tempC * 16));
+  }
+  if(bits & ARCHIVE_HAS_RH){
+    written += putDelta(tag, ARCHIVE_RH, lround(sample.rh * 16));
+  }
+  if(bits & ARCHIVE_HAS_LIGHT){
+    written += putDelta(tag, ARCHIVE_LIGHT, sample.light);
+  }
+  if(bits & ARCHIVE_HAS_MOISTURE){
+    written += putDelta(tag, ARCHIVE_MOISTURE, sample.moisture);
+  }
+  if(bits & ARCHIVE_HAS_BATTERY_MV){
+    written += putDelta(tag, ARCHIVE_BATTERY_MV, lround(sample.batteryMv * 1000));
+  }
+  if(bits & ARCHIVE_HAS_BATTERY_J){
+    written += putDelta(tag, ARCHIVE_BATTERY_J, sample.batteryJ);
+  }
+  archive.bytes += written;
+  ++archive.samples;
+
+  if(ARCHIVE_BLOCK == ++tag.openCount){
+    sealBlock(archive, tag);
+  }
+}
+
+/*
+ * Drops the archive of the tag in slot.
+ */
+void clearArchive(archive_t& archive, int slot){
+  if(archive.tags.size() <= (size_t)slot){
+    return;
+  }
+  archive_tag_t& tag = archive.tags[slot];
+  for(size_t b = 0; b < tag.sealed.size(); ++b){
+    archive.bytes -= tag.sealed[b].data.size() + sizeof(archive_block_t);
+  }
+  for(int c = 0; c < ARCHIVE_COLUMNS; ++c){
+    archive.bytes -= tag.open[c].size();
+  }
+  archive.samples -= archiveCount(archive, slot);
+  tag = archive_tag_t();
+  if(slot == archive.cacheSlot){
+    archive.cacheSlot = 0;
+  }
+}
+
+size_t archiveCount(const archive_t& archive, int slot){
+  if(archive.tags.size() <= (size_t)slot){
+    return 0;
+  }
+  const archive_tag_t& tag = archive.tags[slot];
+  return tag.sealed.size() * ARCHIVE_BLOCK + tag.openCount;
+}
+
+/*
+ * Decodes count samples from the columns of a block into out.  Presence
+ * runs past the end of the presence column come from runBits and
+ * runLength.  Returns false unless the columns hold exactly the values of
+ * count samples.
+ */
+static bool decodeBlock(const unsigned char* column[ARCHIVE_COLUMNS],
+    const unsigned char* end[ARCHIVE_COLUMNS], int64_t firstTime, int count,
+    unsigned char runBits, int runLength, int tagID, vector<pip_sample_t>& out){
+  out.resize(count);
+  int64_t time = firstTime;
+  int64_t interval = 0;
+  int64_t value[ARCHIVE_COLUMNS] = {0};
+  int64_t bits = 0;
+  int64_t left = 0;
+  for(int i = 0; i < count; ++i){
+    if(0 == left){
+      if(column[ARCHIVE_PRESENT] < end[ARCHIVE_PRESENT]){
+        if(not getVarint(column[ARCHIVE_PRESENT], end[ARCHIVE_PRESENT], bits) or
+            not getVarint(column[ARCHIVE_PRESENT], end[ARCHIVE_PRESENT], left)){
+          return false;
+        }
+      }
+      else {
+        bits = runBits;
+        left = runLength;
+        runLength = 0;
+      }
+      if(0 >= left){
+        return false;
+      }
+    }
+    --left;
+
+    pip_sample_t& s = out[i];
+    memset(&s, 0, sizeof(s));
+    initPipData(s);
+    s.tagID = tagID;
+    if(not addVarint(column[ARCHIVE_TIME], end[ARCHIVE_TIME], interval) or
+        not addVarint(column[ARCHIVE_RSSI], end[ARCHIVE_RSSI], value[ARCHIVE_RSSI])){
+      return false;
+    }
+    time += interval;
+    s.time.tv_sec = time / 1000;
+    s.time.tv_usec = (time % 1000) * 1000;
+    s.rssi = value[ARCHIVE_RSSI] / 2.0;
+    if(bits & ARCHIVE_HAS_TEMP){
+      if(not addVarint(column[ARCHIVE_TEMP], end[ARCHIVE_TEMP], value[ARCHIVE_TEMP])){
+        return false;
+      }
+      s.tempC = value[ARCHIVE_TEMP] / 16.0;
+    }
+    if(bits & ARCHIVE_HAS_RH){
+      if(not addVarint(column[ARCHIVE_RH], end[ARCHIVE_RH], value[ARCHIVE_RH])){
+        return false;
+      }
+      s.rh = value[ARCHIVE_RH] / 16.0;
+    }
+    if(bits & ARCHIVE_HAS_LIGHT){
+      if(not addVarint(column[ARCHIVE_LIGHT], end[ARCHIVE_LIGHT], value[ARCHIVE_LIGHT])){
+        return false;
+      }
+      s.light = value[ARCHIVE_LIGHT];
+    }
+    if(bits & ARCHIVE_HAS_MOISTURE){
+      if(not addVarint(column[ARCHIVE_MOISTURE], end[ARCHIVE_MOISTURE], value[ARCHIVE_MOISTURE])){
+        return false;
+      }
+      s.moisture = value[ARCHIVE_MOISTURE];
+    }
+    if(bits & ARCHIVE_HAS_BATTERY_MV){
+      if(not addVarint(column[ARCHIVE_BATTERY_MV], end[ARCHIVE_BATTERY_MV],
+            value[ARCHIVE_BATTERY_MV])){
+        return false;
+      }
+      s.batteryMv = value[ARCHIVE_BATTERY_MV] / 1000.0;
+    }
+    if(bits & ARCHIVE_HAS_BATTERY_J){
+      if(not addVarint(column[ARCHIVE_BATTERY_J], end[ARCHIVE_BATTERY_J],
+            value[ARCHIVE_BATTERY_J])){
+        return false;
+      }
+      s.batteryJ = value[ARCHIVE_BATTERY_J];
+    }
+  }
+  //Every run and every value must have been used
+  if(0 != left or 0 != runLength){
+    return false;
+  }
+  for(int c = 0; c < ARCHIVE_COLUMNS; ++c){
+    if(column[c] != end[c]){
+      return false;
+    }
+  }
+  return true;
+}
+
+/*
+ * Decodes block of the archive of the tag in slot, which holds count
+ * samples, into the archive's cache.  Returns false if it cannot be
+ * decoded.
+ */
+static bool decodeArchiveBlock(archive_t& archive, int slot, size_t block, int count){
+  const archive_tag_t& tag = archive.tags[slot];
+  const unsigned char* column[ARCHIVE_COLUMNS];
+  const unsigned char* end[ARCHIVE_COLUMNS];
+  archive.cacheSlot = 0;
+  if(block < tag.sealed.size()){
+    const archive_block_t& sealed = tag.sealed[block];
+    const unsigned char* data = sealed.data.data();
+    for(int c = 0; c < ARCHIVE_COLUMNS; ++c){
+      column[c] = unpackColumn(data + (0 == c ? 0 : sealed.end[c-1]), data + sealed.end[c],
+          archive.unpacked[c], end[c]);
+      if(NULL == column[c]){
+        return false;
+      }
+    }
+    if(not decodeBlock(column, end, sealed.firstTime, count, 0, 0, tag.tagID, archive.cache)){
+      return false;
+    }
+  }
+  else {
+    for(int c = 0; c < ARCHIVE_COLUMNS; ++c){
+      column[c] = tag.open[c].data();
+      end[c] = column[c] + tag.open[c].size();
+    }
+    if(not decodeBlock(column, end, tag.openFirst, count, tag.runBits, tag.runLength,
+          tag.tagID, archive.cache)){
+      return false;
+    }
+  }
+  archive.cacheSlot = slot;
+  archive.cacheBlock = block;
+  archive.cacheCount = count;
+  return true;
+}
+
+/*
+ * Returns a sample from the archive of the tag in slot, index 0 being the
+ * newest.  The index must be less than archiveCount.  Only the block
+ * holding the sample is decoded, and it stays decoded until another block
+ * is asked for.
+ */
+const pip_sample_t& archivedSample(archive_t& archive, int slot, size_t index){
+  archive_tag_t& tag = archive.tags[slot];
+  size_t position = archiveCount(archive, slot) - 1 - index;
+  size_t block = position / ARCHIVE_BLOCK;
+  int count = block < tag.sealed.size() ? ARCHIVE_BLOCK : tag.openCount;
+  if(slot != archive.cacheSlot or block != archive.cacheBlock or count != archive.cacheCount){
+    //Every block was either written here or checked by validArchive
+    decodeArchiveBlock(archive, slot, block, count);
+  }
+  return archive.cache[position % ARCHIVE_BLOCK];
+}
+
+/*
+ * True if every block in the archive of the tag in slot decodes to exactly
+ * the samples it should hold, as must be checked for an archive that was
+ * not written by archiveSample.
+ */
+bool validArchive(archive_t& archive, int slot){
+  const archive_tag_t& tag = archive.tags[slot];
+  for(size_t b = 0; b < tag.sealed.size(); ++b){
+    if(not decodeArchiveBlock(archive, slot, b, ARCHIVE_BLOCK)){
+      return false;
+    }
+  }
+  return decodeArchiveBlock(archive, slot, tag.sealed.size(), tag.openCount);
+}
+
+/*
+ * Bytes the archived samples take on average, counting the encoded columns
+ * and block headers.
+ */
+double archiveBytesPerSample(const archive_t& archive){
+  return 0 == archive.samples ? 0 : (double)archive.bytes / archive.samples;
+}
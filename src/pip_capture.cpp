@@ -0,0 +1,196 @@
+/*
+ * Copyright (C) 2014 Robert S. Moore II and Rutgers University
+ * All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA
+ * or visit http://www.gnu.org/licenses/gpl-2.0.html
+ */
+
+/*******************************************************************************
+ * @file pip_capture.cpp
+ * Writes raw frames to a capture file in large buffered writes, and maps
+ * capture files back into memory so they can be decoded again without any
+ * parsing or copying.
+ *
+ * @author Robert S. Moore II
+ ******************************************************************************/
+
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <string>
+
+#include <pip_capture.hpp>
+#include <pip_util.hpp>
+
+using std::string;
+
+//The capture being written, if any
+static int captureFd = -1;
+static unsigned char* captureBuffer = NULL;
+static size_t captureUsed = 0;
+//Set once a write failed, the capture is stopped from then on
+static bool captureFailed = false;
+
+/*
+ * Starts a capture.  New records are appended if the file is already a
+ * capture, after cutting off a record left partly written by a crash, which
+ * would shift every record after it.  Otherwise the file is created with a
+ * fresh header.  Refuses to touch any other existing file.
+ */
+bool openCapture(const string& filename){
+  closeCapture();
+  captureFailed = false;
+  bool append = isCaptureFile(filename);
+  struct stat st;
+  if(not append and 0 == stat(filename.c_str(), &st) and st.st_size > 0){
+    return false;
+  }
+  captureFd = open(filename.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+  if(0 > captureFd){
+    return false;
+  }
+  if(append){
+    off_t partial = 0 == fstat(captureFd, &st) ?
+      (st.st_size - sizeof(capture_header_t)) % sizeof(capture_record_t) : -1;
+    if(0 > partial or (0 < partial and 0 != ftruncate(captureFd, st.st_size - partial))){
+      close(captureFd);
+      captureFd = -1;
+      return false;
+    }
+  }
+  captureBuffer = new unsigned char[CAPTURE_BUFFER_SIZE];
+  captureUsed = 0;
+  if(not append){
+    capture_header_t header;
+    memcpy(header.magic, CAPTURE_MAGIC, sizeof(header.magic));
+    header.version = CAPTURE_VERSION;
+    header.recordSize = sizeof(capture_record_t);
+    memcpy(captureBuffer, &header, sizeof(header));
+    captureUsed = sizeof(header);
+  }
+  return true;
+}
+
+void captureFrame(const capture_record_t& record){
+  if(0 > captureFd){
+    return;
+  }
+  if(captureUsed + sizeof(record) > CAPTURE_BUFFER_SIZE and not flushCapture()){
+    return;
+  }
+  memcpy(captureBuffer + captureUsed, &record, sizeof(record));
+  captureUsed += sizeof(record);
+}
+
+/*
+ * Writes out everything buffered so far.  Returns false once a write has
+ * failed, for instance because the disk is full.  The capture is stopped
+ * then, rather than going on with frames missing from it.
+ */
+bool flushCapture(){
+  if(0 > captureFd or 0 == captureUsed){
+    return not captureFailed;
+  }
+  bool written = writeAll(captureFd, captureBuffer, captureUsed);
+  captureUsed = 0;
+  if(not written){
+    closeCapture();
+    captureFailed = true;
+  }
+  return written;
+}
+
+/*
+ * Writes out and closes the capture.  Returns false if any of it could not
+ * be written.
+ */
+bool closeCapture(){
+  if(0 > captureFd){
+    return not captureFailed;
+  }
+  bool written = 0 == captureUsed or writeAll(captureFd, captureBuffer, captureUsed);
+  captureUsed = 0;
+  close(captureFd);
+  captureFd = -1;
+  delete[] captureBuffer;
+  captureBuffer = NULL;
+  captureFailed = captureFailed or not written;
+  return not captureFailed;
+}
+
+/*
+ * True if the file starts with a capture header of a version and record size
+ * this program understands.
+ */
+bool isCaptureFile(const string& filename){
+  int fd = open(filename.c_str(), O_RDONLY | O_CLOEXEC);
+  if(0 > fd){
+    return false;
+  }
+  capture_header_t header;
+  bool valid = (sizeof(header) == read(fd, &header, sizeof(header))) and
+    0 == memcmp(header.magic, CAPTURE_MAGIC, sizeof(header.magic)) and
+    CAPTURE_VERSION == header.version and
+    sizeof(capture_record_t) == header.recordSize;
+  close(fd);
+  return valid;
+}
+
+/*
+ * Maps a capture file for reading.  A partially written last record is
+ * ignored.
+ */
+bool mapCapture(const string& filename, capture_map_t& map){
+  map.base = NULL;
+  map.size = 0;
+  map.records = NULL;
+  map.count = 0;
+  if(not isCaptureFile(filename)){
+    return false;
+  }
+  int fd = open(filename.c_str(), O_RDONLY | O_CLOEXEC);
+  if(0 > fd){
+    return false;
+  }
+  struct stat st;
+  if(0 != fstat(fd, &st)){
+    close(fd);
+    return false;
+  }
+  map.size = st.st_size;
+  map.base = mmap(NULL, map.size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if(MAP_FAILED == map.base){
+    map.base = NULL;
+    return false;
+  }
+  madvise(map.base, map.size, MADV_SEQUENTIAL);
+  map.records = (const capture_record_t*)((const char*)map.base + sizeof(capture_header_t));
+  map.count = (map.size - sizeof(capture_header_t)) / sizeof(capture_record_t);
+  return true;
+}
+
+void unmapCapture(capture_map_t& map){
+  if(NULL != map.base){
+    munmap(map.base, map.size);
+  }
+  map.base = NULL;
+  map.records = NULL;
+  map.count = 0;
+}
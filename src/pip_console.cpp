@@ -31,19 +31,27 @@
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
+#include <poll.h>
+#include <sys/timerfd.h>
 #include <libusb-1.0/libusb.h>
 #include <stdexcept>
 
-#include <arpa/inet.h>
-
+#include <ctime>
+#include <fstream>
 #include <iostream>
 #include <list>
 #include <map>
+#include <vector>
 #include <algorithm>
 
 
 // Ncurses library for fancy printing
 #include <cons_ncurses.hpp>
+#include <pip_aging.hpp>
+#include <pip_usb.hpp>
+#include <pip_replay.hpp>
+#include <pip_sim.hpp>
+#include <pip_stream.hpp>
 
 //Handle interrupt signals to exit cleanly.
 #include <signal.h>
@@ -53,17 +61,40 @@ using std::list;
 using std::map;
 using std::pair;
 
-#define MAX_PACKET_SIZE_READ		(64 *1024 )
-
 //Global variable for the signal handler.
 bool killed = false;
 extern long long int FUN_START_DELAY;
 
+//The open pip devices
+list<pip_receiver_t*> pip_devs;
+//Replay used instead of the pip devices, if any
+pip_replay_t* replaySource = NULL;
+//Stream samples instead of running the console
+bool headless = false;
+//Set by SIGUSR1 to dump the receiver report
+volatile sig_atomic_t dumpReport = 0;
+
+/*
+ * Shows a message in the status bar, or on stderr when there is no console.
+ */
+void report(const string& message){
+  if(headless){
+    std::cerr<<message<<'\n';
+  }
+  else {
+    setStatus(message);
+  }
+}
+
 
 //Signal handler.
 void handler(int signal) {
-  if(signal == SIGINT){
-    setStatus("Shutting down. Use CTRL+C to force exit.");
+  if(signal == SIGUSR1){
+    dumpReport = 1;
+    return;
+  }
+  if(signal == SIGINT or signal == SIGTERM){
+    report("Shutting down. Use CTRL+C to force exit.");
     if (killed) {
       exit(-1);
     }
@@ -72,429 +103,630 @@ void handler(int signal) {
 }
 
 
-float toFloat(unsigned char* pipFloat) {
-    return ((float)pipFloat[0] * 0x100 + (float)pipFloat[1] + (float)pipFloat[2] / (float)0x100);
-}
-
 void cleanShutdown(){
   libusb_exit(NULL);
-  stopNCurses();
+  if(not headless){
+    stopNCurses();
+  }
 }
 
-/* #defines of the commands to the pipsqueak tag */
-#define LM_GET_NEXT_PACKET (0x13)
-
-/* Defined in CC1100 data sheet/errata. */
-#define RSSI_OFFSET 78
-
-
-
-//PIP 3 Byte ID packet structure with variable data segment.
-//3 Byte receiver ID, 21 bit transmitter id, 3 bits of parity plus up to 20 bytes of extra data.
-typedef struct {
-	unsigned char ex_length : 8; //Length of data in the optional data portion
-	unsigned char dropped   : 8; //The number of packet that were dropped if the queue overflowed.
-	unsigned int boardID    : 24;//Basestation ID
-	unsigned int time       : 32;//Timestamp in quarter microseconds.
-	unsigned int tagID      : 24;//Transmitter ID
-//	unsigned int parity     : 3; //Even parity check on the transmitter ID
-	unsigned char rssi      : 8; //Received signal strength indicator
-  unsigned char lqi       : 7; //The lower 7 bits contain the link quality indicator
-	unsigned char crcok     : 1; 
-	unsigned char data[20];      //The optional variable length data segment
-  float rss;
-} __attribute__((packed)) pip_packet_t;
-
-
-//USB PIPs' vendor ID and strings
-const char *silicon_labs_s = "Silicon Labs\0";
-const char *serial_num_s = "1234\0";
-const int PACKET_LEN = 13;
-
-//Map of usb devices in use, accessed by the USB device number
-map<int, bool> in_use;
-//0 for 2.X tags, 1 for GPIP
-#define OLD_PIP 0
-#define GPIP 1
-#define NOT_PIP -1
-map<struct libusb_device_handle*, int8_t> versions;
-
-//The 8051 PIP
-#define SILICON_LABS_VENDOR  ((unsigned short) (0x10C4))
-#define SILICON_LABS_PIPPROD ((unsigned char) (0x03))
-
-//The MSP430 PIP
-#define TI_LABS_VENDOR  ((unsigned short) (0x2047))
-#define TI_LABS_PIPPROD ((unsigned short) (0x0300))
+//Samples handed to updateStates at once
+#define DRAIN_BATCH 256
+//Most samples taken from one ring per wakeup, so a receiver with a backlog
+//cannot keep keys and the other receivers waiting
+#define DRAIN_BUDGET PIP_RING_SIZE
 
+/*
+ * Moves samples from a producer thread's ring into the console state, or
+ * into the output stream when headless, in batches that are rendered as one
+ * update.  Stops after DRAIN_BUDGET samples and asks for another wakeup if
+ * the ring still has more.  Returns the number of samples moved.
+ */
+unsigned long drainSamples(sample_ring_t& samples){
+  static pip_sample_t batch[DRAIN_BATCH];
+  unsigned long count = 0;
+  while(count < DRAIN_BUDGET){
+    size_t taken = 0;
+    while(taken < DRAIN_BATCH and samples.pop(batch[taken])){
+      ++taken;
+    }
+    if(0 == taken){
+      return count;
+    }
+    if(headless){
+      for(size_t i = 0; i < taken; ++i){
+        streamSample(batch[i]);
+      }
+    }
+    else {
+      updateStates(batch, taken);
+    }
+    count += taken;
+  }
+  if(0 < samples.size()){
+    wakePIPs();
+  }
+  return count;
+}
 
 /*
- * Parses the "extra data" portion of the Pip packet into 
- * the actual recorded data.  Values are written into 
- * s if present.
+ * Moves the samples decoded by a receiver's acquisition thread into the
+ * console state.
  */
-void parseData(std::vector<unsigned char>& data,pip_sample_t& s){
-  if(data.size() == 0){
-    return;
+void drainPIP(pip_receiver_t* rcv){
+  drainSamples(rcv->samples);
+  capture_record_t record;
+  while(rcv->captures.pop(record)){
+    captureFrame(record);
   }
-  
-  unsigned char hdr = data[0];
-  int i = 1;
-  // Binary sensing (doors, water, etc.) in bit 0x01
-  // Temperature in bits 0xFE, Celsius, offset 40 degrees
-  if(hdr & 0x01){
-    s.tempC = (data[i]>>1) - 40;
-    ++i;
+  unsigned long overflows = rcv->samples.overflows();
+  if(overflows != rcv->overflowsSeen){
+    rcv->overflowsSeen = overflows;
+    char buff[80];
+    snprintf(buff,79,"Receiver %04x overflowed: %lu samples lost",rcv->deviceNum,overflows);
+    report(buff);
   }
-  // Temperature in Celsius, not offset, in 16ths of a degree.
-  if(hdr & 0x02){
-    s.tempC = ((data[i]<<4) + (data[i+1]/16.0));
-    i += 2;
+  //Frames that did not fit are missing from the capture file
+  overflows = rcv->captures.overflows();
+  if(overflows != rcv->captureOverflowsSeen){
+    rcv->captureOverflowsSeen = overflows;
+    char buff[80];
+    snprintf(buff,79,"Receiver %04x overflowed: %lu frames not captured",rcv->deviceNum,overflows);
+    report(buff);
   }
+}
 
-  // Ambient light based on "dark" (0x00) to bright office (0xFF)
-  if(hdr & 0x04){
-    s.light = data[i];
-    ++i;
+/*
+ * One line summary of the receivers for the status bar.  Bytes copied counts
+ * frame bytes copied out of the transfer buffers while decoding.
+ */
+string usbSummary(){
+  unsigned long frames = 0;
+  unsigned long copied = 0;
+  for (list<pip_receiver_t*>::iterator I = pip_devs.begin(); I != pip_devs.end(); ++I) {
+    frames += (*I)->frames;
+    copied += (*I)->bytesCopied;
   }
+  char buff[80];
+  snprintf(buff,79,"Receivers: %lu  Frames: %lu  Copied: %.1f bytes/frame",
+      (unsigned long)pip_devs.size(),frames,frames ? copied/(double)frames : 0.0);
+  return string(buff);
+}
 
-  /*
-   * Off-chip temperature and relative humidity sensing.
-   * Temperature is 16ths of a degree C.
-   * Relative humidity is in 16ths of a percent.
-   */
-  if(hdr & 0x08){
-    s.tempC = ((data[i]<<4) + (data[i+1]/16.0));
-    i += 2;
-    s.rh = ((data[i]<<4) + (data[i+1]/16.0));
-    i += 2;
+/*
+ * Label of the upper bound of a latency histogram bucket.
+ */
+static string latencyLabel(int bucket){
+  char buff[16];
+  long us = (long)PIP_LATENCY_BASE << bucket;
+  if(PIP_LATENCY_BUCKETS - 1 == bucket){
+    snprintf(buff,15,">=%.1fs",(us/2)/1000000.0);
+  }else if(us < 1000){
+    snprintf(buff,15,"<%ldus",us);
+  }else if(us < 1000000){
+    snprintf(buff,15,"<%.1fms",us/1000.0);
+  }else {
+    snprintf(buff,15,"<%.1fs",us/1000000.0);
   }
+  return string(buff);
+}
 
-  // Skipping 2-byte moisture values for now
-  if(hdr & 0x10){
-    s.moisture = ((data[i]<<8) + (data[i+1]));
-    i += 2;
+/*
+ * Health counters and request to read latency of every receiver, a few lines
+ * per receiver.
+ */
+string receiverReport(){
+  string report;
+  char buff[160];
+  if(pip_devs.empty()){
+    return "No receivers attached.\n";
   }
-
-  // Skipping 6-byte history values for now
-  if(hdr & 0x20){
-    i += 6;
+  for (list<pip_receiver_t*>::iterator I = pip_devs.begin(); I != pip_devs.end(); ++I) {
+    pip_receiver_t* rcv = *I;
+    pip_health_t& h = rcv->health;
+    //Simulated receivers never get transfers
+    const char* kind = (NULL == rcv->slots[0].request) ? "simulated" : (OLD_PIP == rcv->version ? "PIP" : "GPIP");
+    static const char* states[] = {"opening", "active", "backoff", "reset", "failed"};
+    snprintf(buff,159,"Receiver %04x (%s)  %s\n",rcv->deviceNum,kind,states[rcv->state]);
+    report += buff;
+    snprintf(buff,159,"  Requests %lu  Reads %lu  Empty %lu  Partial %lu  Timeouts %lu  Retries %lu  Reconnects %lu\n",
+        (unsigned long)h.requests,(unsigned long)rcv->frames,(unsigned long)h.emptyReads,
+        (unsigned long)h.partialReads,(unsigned long)h.timeouts,(unsigned long)h.retries,
+        (unsigned long)h.reconnects);
+    report += buff;
+    snprintf(buff,159,"  Bytes %lu  Dropped by receiver %lu  Lost in ring %lu  Not captured %lu\n",
+        (unsigned long)h.bytes,(unsigned long)h.dropped,rcv->samples.overflows(),
+        rcv->captures.overflows());
+    report += buff;
+    if (0 != h.startupUs) {
+      snprintf(buff,159,"  Startup %.1f ms  Last open %.1f ms\n",
+          h.startupUs/1000.0,h.openUs/1000.0);
+      report += buff;
+    }
+    string errors;
+    for (int code = 0; code < PIP_ERROR_CODES; ++code) {
+      unsigned long count = h.errors[code];
+      if (0 < count) {
+        snprintf(buff,159,"  %s %lu",
+            PIP_ERROR_CODES - 1 == code ? "OTHER" : libusb_error_name(-code),count);
+        errors += buff;
+      }
+    }
+    report += "  Errors:" + (errors.empty() ? string("  none") : errors) + "\n";
+    //Histogram, only the buckets that were hit, a few per line
+    string latency = "  Latency:";
+    int shown = 0;
+    for (int bucket = 0; bucket < PIP_LATENCY_BUCKETS; ++bucket) {
+      unsigned long count = h.latency[bucket];
+      if (0 == count) {
+        continue;
+      }
+      if (0 < shown and 0 == shown % 5) {
+        report += latency + "\n";
+        latency = "          ";
+      }
+      snprintf(buff,159,"  %s %lu",latencyLabel(bucket).c_str(),count);
+      latency += buff;
+      ++shown;
+    }
+    report += latency + (0 == shown ? "  none\n" : "\n");
   }
+  return report;
+}
 
-  /*
-   * Battery status.  First is the battery voltage measured in millivolts.
-   * Second is the estimated number of Joules consumed since start-up.
-   */
-  if(hdr & 0x40){
-    s.batteryMv = ((data[i]<<8) + (data[i+1]))/1000.0;
-    i += 2;
-    s.batteryJ = ((data[i]<<8) + (data[i+1]));
-    i += 2;
+/*
+ * Writes the receiver report to a time stamped file.  Returns a message for
+ * the status bar.
+ */
+string saveReceiverReport(){
+  char filename[64];
+  time_t now = time(NULL);
+  strftime(filename,63,"receivers-%Y%m%d_%H%M%S.txt",localtime(&now));
+  std::ofstream out(filename);
+  if (not (out << receiverReport())) {
+    return "Unable to save receiver report.";
   }
-
+  return string("Saved receiver report to \"") + filename + "\".";
 }
 
+/*
+ * Drains every receiver and closes the ones that failed for good or were
+ * stopped.  Receivers recover from errors on their own threads, see run()
+ * in pip_usb.cpp, so only receivers that were unplugged or could not be
+ * reconnected end up here.  Their threads have ended by the time they are
+ * closed, so closing never waits.
+ */
+void serviceReceivers(list<pip_receiver_t*>& pip_devs, bool hotplug){
+  bool rescan = false;
+  for (list<pip_receiver_t*>::iterator I = pip_devs.begin(); I != pip_devs.end(); ++I) {
+    drainPIP(*I);
+    //Stopped after it left the bus, see updatePIPs
+    if ((*I)->closing and (*I)->stopped) {
+      closePIP(*I);
+      *I = NULL;
+      continue;
+    }
+    //Receivers are opened in the background, report each one once it is up
+    if (not (*I)->announced and 0 != (*I)->health.startupUs) {
+      (*I)->announced = true;
+      char buff[80];
+      snprintf(buff,79,"Receiver %04x ready after %.0f ms",
+          (*I)->deviceNum,(*I)->health.startupUs/1000.0);
+      report(buff);
+    }
+    //A failed receiver's thread ends on its own
+    if (PIP_STATE_FAILED != (*I)->state or not (*I)->stopped) {
+      continue;
+    }
+    //Nothing more to do for a receiver that could not be opened at all, a
+    //rescan would only fail again
+    if (0 == (*I)->health.startupUs) {
+      char buff[80];
+      snprintf(buff,79,"Receiver %04x could not be opened: %s",
+          (*I)->deviceNum,libusb_error_name((*I)->error));
+      report(buff);
+      closePIP(*I);
+      *I = NULL;
+      continue;
+    }
+    //An unplugged pip is attached again when it comes back.  One that was
+    //given up on may still be there, so look for it once when no other
+    //event would announce it.
+    if (LIBUSB_ERROR_NO_DEVICE != (*I)->error) {
+      char buff[80];
+      snprintf(buff,79,"Receiver %04x failed to reconnect: %s",
+          (*I)->deviceNum,libusb_error_name((*I)->error));
+      report(buff);
+      rescan = hotplug;
+    }
+    closePIP(*I);
+    *I = NULL;
+  }
+  //Clear dead connections
+  pip_devs.remove(NULL);
+  if (rescan) {
+    attachPIPs(pip_devs);
+  }
+}
 
 /*
- * Legacy code (from GRAIL?) that needs to be replaced.
- * 
- * Idea: Scan the USB tree, extract PIPs, grab a packet (to read ID), and 
- *       present them to the user to pick one.
+ * Moves replayed samples into the console state.  Once the whole file has
+ * been played the throughput of the state and render pipeline is reported.
  */
-void attachPIPs(list<libusb_device_handle*> &pip_devs) {
-  //Keep track of the count of USB devices. Don't check if this doesn't change.
-  //static int last_usb_count = 0;
-  //TODO FIXME Try out that optimization (skipping the check) if this is slow
-  //An array of pointers to usb devices.
-  libusb_device **devices = NULL;
-
-  /* Slot numbers used to differentiate multiple PIP USB connections. */
-  int slot = 0;
-
-  //Get the device list
-  ssize_t count = libusb_get_device_list(NULL, &devices);
-
-  //Scan for new pips
-  for (int dev_idx = 0; dev_idx < count; ++dev_idx) {
-    int8_t version = NOT_PIP;
-    libusb_device* dev = devices[dev_idx];
-    libusb_device_descriptor desc;
-    if (0 >= libusb_get_device_descriptor(dev, &desc)) {
-
-      if (((unsigned short) desc.idVendor ==  (unsigned short) TI_LABS_VENDOR) and
-          ((unsigned short) desc.idProduct == (unsigned short) TI_LABS_PIPPROD)) {
-        version = GPIP;
-      }
-      else if (((unsigned short) desc.idVendor ==  (unsigned short) SILICON_LABS_VENDOR) and
-          ((unsigned short) desc.idProduct == (unsigned short) SILICON_LABS_PIPPROD)) {
-        version = OLD_PIP;
-      }
-      //Make the device number a combination of bus number and the address on the bus
-      int device_num = 0x100 * libusb_get_bus_number(dev) + libusb_get_device_address(dev);
-
-      //See if we found a pip that is not already open
-      if (NOT_PIP != version && not in_use[device_num]) {
-        ++slot;
-//        std::cerr<<"Connected to USB Tag Reader.\n";
-        libusb_device_handle* new_handle;
-        int err = libusb_open(dev, &new_handle);
-
-        if (0 != err) {
-          if (LIBUSB_ERROR_ACCESS == err) {
-//            std::cout<<"Insufficient permission to open reader (try sudo).\n";
-          }
-        }
-        //Otherwise getting a handle was successful
-        else {
-          //Reset the device before trying to use it
-          if (0 == libusb_reset_device(new_handle)) {
-            //Add the new device to the pip device list.
-            pip_devs.push_back(new_handle);
-//            std::cout<<"New pipsqueak opened.\n";
-            in_use[device_num] = true;
-            versions[new_handle] = version;
-
-            int retval = libusb_set_configuration(pip_devs.back(), 1);
-            if (0 != retval ) { 
-              switch(retval){
-                case LIBUSB_ERROR_NOT_FOUND:
-                  //printf("Device not found.\n");
-                  break;
-                  case LIBUSB_ERROR_BUSY: 
-                  //printf("Device is busy.\n");
-                  retval = libusb_detach_kernel_driver(pip_devs.back(),0);
-                  if(0 != retval){
-                    //printf("Unable to detach kernel driver with error number %d.\n",retval);
-                  }
-                  retval = libusb_set_configuration(pip_devs.back(),1);
-                  break;
-                  case LIBUSB_ERROR_NO_DEVICE:
-                  //printf("No device present.\n");
-                  break;
-                  default:
-                  //printf("Unknown error.\n");
-                  break;
-              }
-              //printf("Setting configuration to 1 failed with error number %d \n",retval);
-            }
-            else {
-              int interface_num = 0;
-
-              //Detach the kernel driver on linux
-              if (libusb_kernel_driver_active(pip_devs.back(), interface_num)) {
-                libusb_detach_kernel_driver(pip_devs.back(), interface_num);
-              }
-              //Retry claiming the device up to two times.
-              int retries = 2;
-
-              while ((retval = libusb_claim_interface(pip_devs.back(), interface_num)) && retries-- > 0) {
-                ;
-              }
-              //int alt_setting = 0;
-              //libusb_set_interface_alt_setting(pip_devs.back(), interface_num, alt_setting);
-              if (0 == retries) {
-//                std::cerr<<"usb_claim_interface failed\n";
-//                std::cerr<<"If the interface cannot be claimed try running with root privileges.\n";
-              }
-            }
-          }
-        }
-      }
+void drainReplay(pip_replay_t* replay){
+  replay->consumed += drainSamples(replay->samples);
+  if(replay->done and replay->consumed == replay->produced){
+    timeval tval;
+    gettimeofday(&tval, NULL);
+    double seconds = (tval.tv_sec * 1000.0 + tval.tv_usec/1000.0 - replay->started)/1000.0;
+    char buff[100];
+    snprintf(buff,99,"Replayed %lu samples in %.2f s (%.0f samples/s), %lu skipped.",
+        replay->consumed,seconds,seconds > 0 ? replay->consumed/seconds : 0.0,
+        (unsigned long)replay->skipped);
+    report(buff);
+    stopReplay(replay);
+    replaySource = NULL;
+    //Nothing more will arrive, so a headless replay is finished
+    if(headless){
+      killed = true;
     }
   }
+}
 
-  //Free the device list
-  libusb_free_device_list(devices, true);
+/*
+ * Prints the command line options.
+ */
+void usage(const char* name){
+  std::cerr<<"Usage: "<<name<<" [--fun] [--capture <file>] [--replay <file> [--speed <factor>|max]]\n";
+  std::cerr<<"       "<<name<<" [--fun] [--capture <file>] --simulate <tags>[,<option>=<value>...]\n";
+  std::cerr<<"Add --headless [--output <file>|-|fd:<n>] [--format text|binary] to any of these\n";
+  std::cerr<<"to stream samples instead of showing the console.\n";
+  std::cerr<<"  --fun              Start the screen saver after 10 seconds.\n";
+  std::cerr<<"  --capture <file>   Append every raw frame received to a capture file.\n";
+  std::cerr<<"  --replay <file>    Play back a recording or capture instead of reading receivers.\n";
+  std::cerr<<"  --speed <factor>   Replay at factor times real time (default 1),\n";
+  std::cerr<<"                     or as fast as possible with \"max\".\n";
+  std::cerr<<"  --simulate <spec>  Generate frames from simulated receivers instead of reading\n";
+  std::cerr<<"                     receivers.  Options: tags (1-"<<SIM_MAX_TAGS<<"), receivers,\n";
+  std::cerr<<"                     first (tag ID), period (ms), spread (fraction of the period),\n";
+  std::cerr<<"                     rssi (mean dBm), rssidev (dB), sensors (header bits), seed.\n";
+  std::cerr<<"  --expire <n>[,save] Drop tags not heard for n of their broadcast periods,\n";
+  std::cerr<<"                     saving their history to a snapshot file with \"save\".\n";
+  std::cerr<<"  --history-memory <MB>  Memory for the history of all tags (default "<<AGING_DEFAULT_MEMORY<<",\n";
+  std::cerr<<"                     0 for no limit), the least recently heard lose theirs first.\n";
+  std::cerr<<"  --fps <n>          Draw new samples at most n times a second (default "<<FRAME_RATE<<").\n";
+  std::cerr<<"  --state <file>     Save the tags and their history to a file while running\n";
+  std::cerr<<"                     and on exit, and carry on from it when started again.\n";
+  std::cerr<<"  --headless         Do not start the console, stream every sample instead.\n";
+  std::cerr<<"  --output <dest>    Stream to a file, standard output (\"-\", the default),\n";
+  std::cerr<<"                     or an open descriptor (\"fd:<n>\").\n";
+  std::cerr<<"  --format <format>  Stream text lines (\"text\", the default) or binary records.\n";
 }
 
+//Slots in the poll set, followed by libusb's own file descriptors
+#define POLL_STDIN 0
+#define POLL_TIMER 1
+#define POLL_WAKE 2
+#define POLL_USB 3
+
+//Period of the timer for housekeeping, in milliseconds
+#define TIMER_PERIOD 1000
+//Period of the checkpoints of the console state, in milliseconds
+#define STATE_CHECKPOINT_PERIOD 60000
 
 /*
  * Main method, scans for USB devices, reads Pip packets (if Pipsqueak device
  * found), and checks for user input on keyboard.  When Ctrl+C (SIGINT) is
  * detected, "killed" will become false, and main will exit.
+ *
+ * The main thread sleeps in poll() until a key is pressed, an acquisition
+ * thread has samples, libusb has (hotplug) events, or the housekeeping timer
+ * fires.
  */
 int main(int argc, char** argv){
 
-  if(argc > 1){
-    if(strncmp(argv[1],"--fun",5) == 0){
+  string replayFile;
+  string captureFile;
+  double replaySpeed = 1.0;
+  bool simulating = false;
+  string streamDestination = "-";
+  int streamFormat = STREAM_TEXT;
+  pip_sim_config_t simConfig;
+  double expirePeriods = 0;
+  bool saveExpired = false;
+  long historyMemory = AGING_DEFAULT_MEMORY;
+  string stateFile;
+  long frameRate = FRAME_RATE;
+  for(int arg = 1; arg < argc; ++arg){
+    if(strncmp(argv[arg],"--fun",5) == 0){
       FUN_START_DELAY = 10;
     }
+    else if(strcmp(argv[arg],"--replay") == 0 and arg+1 < argc){
+      replayFile = argv[++arg];
+    }
+    else if(strcmp(argv[arg],"--simulate") == 0 and arg+1 < argc){
+      simulating = true;
+      if(not parseSimConfig(argv[++arg], simConfig)){
+        usage(argv[0]);
+        return 1;
+      }
+    }
+    else if(strcmp(argv[arg],"--headless") == 0){
+      headless = true;
+    }
+    else if(strcmp(argv[arg],"--output") == 0 and arg+1 < argc){
+      streamDestination = argv[++arg];
+    }
+    else if(strcmp(argv[arg],"--format") == 0 and arg+1 < argc){
+      ++arg;
+      if(strcmp(argv[arg],"text") == 0){
+        streamFormat = STREAM_TEXT;
+      }
+      else if(strcmp(argv[arg],"binary") == 0){
+        streamFormat = STREAM_BINARY;
+      }
+      else {
+        usage(argv[0]);
+        return 1;
+      }
+    }
+    else if(strcmp(argv[arg],"--expire") == 0 and arg+1 < argc){
+      char* end;
+      expirePeriods = strtod(argv[++arg],&end);
+      saveExpired = strcmp(end,",save") == 0;
+      if(expirePeriods <= 0 or (*end and not saveExpired)){
+        usage(argv[0]);
+        return 1;
+      }
+    }
+    else if(strcmp(argv[arg],"--history-memory") == 0 and arg+1 < argc){
+      char* end;
+      historyMemory = strtol(argv[++arg],&end,10);
+      if(historyMemory < 0 or *end){
+        usage(argv[0]);
+        return 1;
+      }
+    }
+    else if(strcmp(argv[arg],"--fps") == 0 and arg+1 < argc){
+      char* end;
+      frameRate = strtol(argv[++arg],&end,10);
+      if(frameRate <= 0 or 1000 < frameRate or *end){
+        usage(argv[0]);
+        return 1;
+      }
+    }
+    else if(strcmp(argv[arg],"--state") == 0 and arg+1 < argc){
+      stateFile = argv[++arg];
+    }
+    else if(strcmp(argv[arg],"--capture") == 0 and arg+1 < argc){
+      captureFile = argv[++arg];
+    }
+    else if(strcmp(argv[arg],"--speed") == 0 and arg+1 < argc){
+      ++arg;
+      replaySpeed = strcmp(argv[arg],"max") == 0 ? REPLAY_SPEED_MAX : atof(argv[arg]);
+      if(REPLAY_SPEED_MAX != replaySpeed and replaySpeed <= 0){
+        usage(argv[0]);
+        return 1;
+      }
+    }
+    else {
+      usage(argv[0]);
+      return 1;
+    }
+  }
+  //Simulated receivers stand in for real ones, a replay for both
+  if(simulating and not replayFile.empty()){
+    usage(argv[0]);
+    return 1;
+  }
+  //There is no console state to keep when headless
+  if(headless and not stateFile.empty()){
+    usage(argv[0]);
+    return 1;
+  }
+  if(not captureFile.empty()){
+    //Replays have no raw frames to capture
+    if(not replayFile.empty()){
+      usage(argv[0]);
+      return 1;
+    }
+    if(not openCapture(captureFile)){
+      std::cerr<<"Unable to open capture file \""<<captureFile<<"\".\n";
+      return 1;
+    }
+    capturingFrames = true;
+  }
+  if(not replayFile.empty()){
+    replaySource = startReplay(replayFile, replaySpeed);
+    if(NULL == replaySource){
+      std::cerr<<"Unable to read replay file \""<<replayFile<<"\".\n";
+      return 1;
+    }
   }
 
-  // Prepare ncurses
-  initNCurses();
+  if(headless){
+    if(not openStream(streamDestination, streamFormat)){
+      std::cerr<<"Unable to open output \""<<streamDestination<<"\".\n";
+      return 1;
+    }
+    //A closed pipe shows up as a failed write instead
+    signal(SIGPIPE, SIG_IGN);
+  }
+  else {
+    setTagAging(expirePeriods, saveExpired, historyMemory);
+    setFrameRate(frameRate);
+    // Prepare ncurses
+    initNCurses();
+    if(not stateFile.empty()){
+      loadConsoleState(stateFile);
+    }
+  }
   
   //Set up a signal handler to catch interrupt signals so we can close gracefully
   signal(SIGINT, handler);  
+  signal(SIGTERM, handler);
+  signal(SIGUSR1, handler);
 
   //Now connect to pip devices and send their packet data to the aggregation server.
-  unsigned char msg[128];
-  unsigned char buf[MAX_PACKET_SIZE_READ];
-  list<libusb_device_handle*> pip_devs;
   //Set up the USB for a single context (pass NULL as the context)
   libusb_init(NULL);
   libusb_set_debug(NULL, 3);
 
-  //Attach new pip devices.
-  attachPIPs(pip_devs);
-  //Remember when the USB tree was last checked and check it occasionally
+  //Attach and detach pip devices as they come and go if libusb supports
+  //hotplug, otherwise scan the bus for new pip devices occasionally.
+  //Replays and simulations do not use the pip devices at all.
+  bool useUSB = (NULL == replaySource) and not simulating;
+  bool hotplug = useUSB and watchPIPs();
+  if (useUSB and not hotplug) {
+    attachPIPs(pip_devs);
+  }
+  if (simulating) {
+    startSimulation(pip_devs, simConfig);
+  }
+  //Remember when the USB tree was last checked and check it occasionally,
+  //likewise for the last checkpoint of the console state
   double last_usb_check;
-  double last_ch_check;
   {
     timeval tval;
     gettimeofday(&tval, NULL);
     last_usb_check = tval.tv_sec*1000.0;
-    last_ch_check = tval.tv_sec*1000.0 + tval.tv_usec/1000.0;
+  }
+  double last_checkpoint = last_usb_check;
+
+  int timerFd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+  {
+    itimerspec period;
+    period.it_interval.tv_sec = TIMER_PERIOD / 1000;
+    period.it_interval.tv_nsec = (TIMER_PERIOD % 1000) * 1000000;
+    period.it_value = period.it_interval;
+    timerfd_settime(timerFd, 0, &period, NULL);
   }
 
+  std::vector<pollfd> fds;
   while (not killed) {
 
     //A try/catch block is set up to handle exception during quitting.
     try {
       while (not killed) {
-        //Check for new USB devices every second
-        double cur_time;
-        {
-          timeval tval;
-          gettimeofday(&tval, NULL);
-          cur_time = tval.tv_sec * 1000.0 + tval.tv_usec/1000.0;
+        //Requested by SIGUSR1, which also interrupts poll
+        if (dumpReport) {
+          dumpReport = 0;
+          if (headless) {
+            std::cerr<<receiverReport();
+          }
+          else {
+            setStatus(saveReceiverReport());
+          }
         }
-        if(cur_time - last_ch_check > 50){
-          last_ch_check = cur_time;
-          ncursesUserInput();
+
+        fds.resize(POLL_USB);
+        //Headless there are no keys to read, and poll ignores negative descriptors
+        fds[POLL_STDIN].fd = headless ? -1 : STDIN_FILENO;
+        fds[POLL_TIMER].fd = timerFd;
+        fds[POLL_WAKE].fd = pipWakeFd();
+        for (int i = 0; i < POLL_USB; ++i) {
+          fds[i].events = POLLIN;
         }
-        if (cur_time - last_usb_check > 30000) {
-          last_usb_check = cur_time;
-          attachPIPs(pip_devs);
-          //Remove any duplicate devices
-          pip_devs.sort();
-          pip_devs.unique();
+        //libusb may add and remove descriptors at any time so ask every time
+        const libusb_pollfd** usbFds = libusb_get_pollfds(NULL);
+        for (int i = 0; NULL != usbFds and NULL != usbFds[i]; ++i) {
+          pollfd pfd;
+          pfd.fd = usbFds[i]->fd;
+          pfd.events = usbFds[i]->events;
+          fds.push_back(pfd);
+        }
+        libusb_free_pollfds(usbFds);
+        for (size_t i = 0; i < fds.size(); ++i) {
+          fds[i].revents = 0;
         }
 
+        //libusb may also need to be called back when its next timeout expires,
+        //and new samples are drawn when the next frame is due
+        int timeout = -1;
+        timeval usbTimeout;
+        if (1 == libusb_get_next_timeout(NULL, &usbTimeout)) {
+          timeout = usbTimeout.tv_sec * 1000 + (usbTimeout.tv_usec + 999) / 1000;
+        }
+        int wait = timeout;
+        int frame = headless ? -1 : frameWait();
+        if (0 <= frame and (0 > wait or frame < wait)) {
+          wait = frame;
+        }
+
+        if (0 > poll(&fds[0], fds.size(), wait)) {
+          //Interrupted by a signal, check if we were killed
+          continue;
+        }
 
-        if (pip_devs.size() > 0) {
-          //If there isn't any data on USB then sleep for a bit to reduce CPU load.
-          bool got_packet = false;
-          for (list<libusb_device_handle*>::iterator I = pip_devs.begin(); I != pip_devs.end(); ++I) {
-            //A pip can fail up to two times in a row if this is the first time querying it.
-            //If the pip fails after three retries then this pip libusb_device_handle is no longer
-            //valid, probably because the pip was removed from the USB.
-            int retries_left = 3;
-            int transferred = -1;
-            int retval = -1;
-            //A return value of -99 means unknown error. In many cases we should detach and reconnect.
-            while (-99 != retval and retval != LIBUSB_ERROR_NO_DEVICE and transferred < 0 and retries_left > 0) {
-              // Request the next packet from the pip
-              unsigned int timeout = 100;
-              msg[0] = LM_GET_NEXT_PACKET;
-              retval = libusb_bulk_transfer(*I, 2 | LIBUSB_ENDPOINT_OUT, msg, 1, &transferred, timeout);
-              if (0 > retval) {
-//                std::cout<<"Error requesting data: "<<strerror(retval)<<'\n';
-              }
-              else {
-                memset(buf, 0, MAX_PACKET_SIZE_READ);	  
-
-                //Allow up to 20 extra bytes of sensor data beyond the normal packet length.
-                if(0 == versions[*I]) {
-                  retval = libusb_bulk_transfer(*I, 1 | LIBUSB_ENDPOINT_IN, buf+1, PACKET_LEN+20, &transferred, timeout);
-                  if (0 > retval) {
-//                    std::cout<<"Error transferring data (old pip): "<<strerror(retval)<<'\n';
-                  }
-                }
-                else {
-                  retval = libusb_bulk_transfer(*I, 2 | LIBUSB_ENDPOINT_IN, buf+1, PACKET_LEN+20, &transferred, timeout);
-                  if (0 > retval) {
-//                    std::cout<<"Error transferring data (gpip): "<<strerror(retval)<<'\n';
-                  }
-                }
-                //Fill in the length of the extra portion of the packet
-                buf[0] = transferred - PACKET_LEN;
-              }
-              --retries_left;
-            }
-            //TODO FIXME Check for partial transfers
-            //If the pip fails 3 times in a row then it was probably disconnected.
-            //If it is still attached to the interface it will be detected again.
-            if (retval < 0) {
-              //In older versions of libusb1.0 this is an unrecoverable error that destroys the library.
-              //Close everything and try again
-              if (-99 == retval) {
-                for (list<libusb_device_handle*>::iterator I = pip_devs.begin(); I != pip_devs.end(); ++I) {
-                  libusb_release_interface(*I, 0);
-                  libusb_close(*I);
-                  *I = NULL;
-                }
-                cleanShutdown();
-                return 0;
-              }
-              else if (LIBUSB_ERROR_NO_DEVICE == retval) {
-//                std::cerr<<"Device disconnected\n";
-                libusb_release_interface(*I, 0);
-                libusb_close(*I);
-                *I = NULL;
-              }
-              else {
-                std::cerr<<"Trying to detach\n";
-                //libusb_reset_device (*I);
-                //libusb_clear_halt(*I, 0);
-                libusb_release_interface(*I, 0);
-                libusb_close(*I);
-                *I = NULL;
-                std::cerr<<"Detached\n";
-                std::cerr<<"At this point in time the flawed libusb probably cannot attach new devices.\n";
-              }
-            }
-            //If the length of the message is equal to or greater than PACKET_LEN then this is a data packet.
-            else if (PACKET_LEN <= transferred) {
-              //Data is flowing over USB, continue polling
-              got_packet = true;
-              //Overlay the packet struct on top of the pointer to the pip's message.
-              pip_packet_t *pkt = (pip_packet_t *)buf;
-
-              //Check to make sure this was a good packet.
-              if ((pkt->rssi != (int) 0) and (pkt->lqi != 0) and (pkt->crcok)) {
-                unsigned char* data = (unsigned char*)pkt;
-
-                  unsigned int netID = ((unsigned int)data[9] * 65536)  + ((unsigned int)data[10] * 256) +
-                    ((unsigned int)data[11] );
-                  //We do not currently use the pip's local timestamp
-                  //unsigned long time = ntohl(pkt->time);
-//                  unsigned long baseID = ntohl(pkt->boardID << 8);
-                  pip_sample_t s;
-                  s.tagID = netID;
-
-                  //Set this to the real timestamp, milliseconds since 1970
-                  timeval tval;
-                  gettimeofday(&tval,NULL);
-                  s.time = tval;
-                  s.rcvTime = ntohl(pkt->time);
-                  s.dropped = pkt->dropped;
-                  //Convert from one byte value to a float for receive signal
-                  //strength as described in the TI/chipcon Design Note DN505 on cc1100
-                  s.rssi = ( (pkt->rssi) >= 128 ? (signed int)(pkt->rssi-256)/2.0 : (pkt->rssi)/2.0) - RSSI_OFFSET;
-                  initPipData(s);
-                  if(pkt->ex_length){
-                    std::vector<unsigned char> dat(pkt->data, pkt->data+buf[0]);
-                    parseData(dat,s);
-                  }
-                  
-                  updateState(s);
-
-              }
-            }
+        if (fds[POLL_STDIN].revents) {
+          ncursesUserInput();
+        }
+
+        bool usbReady = (0 <= timeout);
+        for (size_t i = POLL_USB; i < fds.size(); ++i) {
+          if (fds[i].revents) {
+            usbReady = true;
+          }
+        }
+        if (usbReady) {
+          //Hotplug callbacks run from here
+          timeval zero = {0, 0};
+          libusb_handle_events_timeout_completed(NULL, &zero, NULL);
+          if (hotplug) {
+            updatePIPs(pip_devs);
           }
-          //If there isn't any current data on USB then sleep to
-          //reduce CPU consumption
-          if (not got_packet) {
-            usleep(100);
+        }
+
+        if (fds[POLL_WAKE].revents) {
+          clearPIPWake();
+          serviceReceivers(pip_devs, hotplug);
+          if (NULL != replaySource) {
+            drainReplay(replaySource);
           }
         }
-        else {
-          //Sleep for a second if there aren't even any pip devices
-          usleep(1000000);
+
+        if (not headless and 0 == frameWait()) {
+          renderFrame();
+        }
+
+        if (fds[POLL_TIMER].revents) {
+          uint64_t expirations;
+          if (sizeof(expirations) != read(timerFd, &expirations, sizeof(expirations))) {
+            //Spurious wakeup, nothing expired
+          }
+          //Check for new USB devices every 30 seconds if there is no hotplug
+          double cur_time;
+          {
+            timeval tval;
+            gettimeofday(&tval, NULL);
+            cur_time = tval.tv_sec * 1000.0 + tval.tv_usec/1000.0;
+          }
+          //Don't leave captured frames or streamed samples sitting in buffers for long
+          if (capturingFrames and not flushCapture()) {
+            capturingFrames = false;
+            report("Unable to write to capture file \"" + captureFile + "\", capture stopped.");
+          }
+          if (not headless) {
+            refreshReceivers();
+            ageConsole();
+          }
+          if (not flushStream()) {
+            report("Unable to write samples, exiting.");
+            killed = true;
+          }
+          if (useUSB and not hotplug and cur_time - last_usb_check > 30000) {
+            last_usb_check = cur_time;
+            attachPIPs(pip_devs);
+          }
+          //Checkpoints are written in the background, one at a time
+          if (not finishConsoleWrites(false)) {
+            report("Unable to save state to \"" + stateFile + "\".");
+          }
+          if (not stateFile.empty() and cur_time - last_checkpoint > STATE_CHECKPOINT_PERIOD) {
+            last_checkpoint = cur_time;
+            startConsoleCheckpoint(stateFile);
+          }
         }
-        //Clear dead connections
-        pip_devs.remove(NULL);
       }
     }
     catch (std::runtime_error& re) {
@@ -505,13 +737,28 @@ int main(int argc, char** argv){
     }
   }
 //  std::cerr<<"Exiting\n";
+  close(timerFd);
   //Clean up the pip connections before exiting.
-  for (list<libusb_device_handle*>::iterator I = pip_devs.begin(); I != pip_devs.end(); ++I) {
-    libusb_release_interface(*I, 0);
-    libusb_close(*I);
+  for (list<pip_receiver_t*>::iterator I = pip_devs.begin(); I != pip_devs.end(); ++I) {
+    closePIP(*I);
   }
+  if (NULL != replaySource) {
+    stopReplay(replaySource);
+  }
+  bool captureWritten = closeCapture();
+  closeStream();
+  //Nothing arrives any more, so this is the state the next run starts from.
+  //A checkpoint still being written would race it for the file.
+  finishConsoleWrites(true);
+  bool stateSaved = stateFile.empty() or saveConsoleState(stateFile);
   cleanShutdown();
+  if (not captureWritten) {
+    std::cerr<<"Unable to write to capture file \""<<captureFile<<"\", capture is incomplete.\n";
+  }
+  if (not stateSaved) {
+    std::cerr<<"Unable to save state to \""<<stateFile<<"\".\n";
+    return 1;
+  }
   return 0;
 }
 
-
@@ -0,0 +1,119 @@
+/*
+ * Copyright (C) 2014 Robert S. Moore II and Rutgers University
+ * All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA
+ * or visit http://www.gnu.org/licenses/gpl-2.0.html
+ */
+
+/*******************************************************************************
+ * @file pip_history.cpp
+ * Per-tag history rings carved from one arena of samples.
+ *
+ * @author Robert S. Moore II
+ ******************************************************************************/
+
+#include <pip_history.hpp>
+
+/*
+ * Takes a block from the arena, growing it if no block is free.
+ */
+static int takeBlock(history_arena_t& arena){
+  if(not arena.freeBlocks.empty()){
+    int block = arena.freeBlocks.back();
+    arena.freeBlocks.pop_back();
+    return block;
+  }
+  int block = arena.samples.size() / HISTORY_BLOCK;
+  arena.samples.resize(arena.samples.size() + HISTORY_BLOCK);
+  return block;
+}
+
+/*
+ * Where position pos of the ring lies in the arena.
+ */
+static inline size_t arenaIndex(const history_ring_t& ring, int pos){
+  return (size_t)ring.blocks[pos / HISTORY_BLOCK] * HISTORY_BLOCK + pos % HISTORY_BLOCK;
+}
+
+/*
+ * Adds a sample to the history of the tag in slot, dropping its oldest
+ * sample if the history is full.
+ */
+void appendHistory(history_arena_t& arena, int slot, const pip_sample_t& sample){
+  if(arena.rings.size() <= (size_t)slot){
+    arena.rings.resize(slot + 1);
+  }
+  history_ring_t& ring = arena.rings[slot];
+  int pos;
+  if(ring.count < HISTORY_DEPTH){
+    //Still growing, so the ring has not wrapped and the next position is count
+    pos = ring.count;
+    if(pos == ring.numBlocks * HISTORY_BLOCK){
+      int block = takeBlock(arena);
+      ring.blocks[ring.numBlocks++] = block;
+    }
+    ++ring.count;
+  }
+  else {
+    pos = ring.start;
+    ring.start = (ring.start + 1) % HISTORY_DEPTH;
+  }
+  arena.samples[arenaIndex(ring, pos)] = sample;
+  ++ring.total;
+}
+
+/*
+ * Empties the history of the tag in slot and returns its blocks to the arena.
+ */
+void clearHistory(history_arena_t& arena, int slot){
+  if(arena.rings.size() <= (size_t)slot){
+    return;
+  }
+  history_ring_t& ring = arena.rings[slot];
+  arena.freeBlocks.insert(arena.freeBlocks.end(), ring.blocks, ring.blocks + ring.numBlocks);
+  ring.numBlocks = 0;
+  ring.start = 0;
+  ring.count = 0;
+  ring.total = 0;
+}
+
+int historyCount(const history_arena_t& arena, int slot){
+  return arena.rings.size() <= (size_t)slot ? 0 : arena.rings[slot].count;
+}
+
+unsigned long historyTotal(const history_arena_t& arena, int slot){
+  return arena.rings.size() <= (size_t)slot ? 0 : arena.rings[slot].total;
+}
+
+/*
+ * Returns a sample from the history of the tag in slot, index 0 being the
+ * newest.  The index must be less than historyCount.
+ */
+const pip_sample_t& historySample(const history_arena_t& arena, int slot, int index){
+  const history_ring_t& ring = arena.rings[slot];
+  int pos = ring.start + ring.count - 1 - index;
+  if(pos >= HISTORY_DEPTH){
+    pos -= HISTORY_DEPTH;
+  }
+  return arena.samples[arenaIndex(ring, pos)];
+}
+
+/*
+ * Bytes of the arena holding samples, not counting free blocks.
+ */
+size_t historyBytes(const history_arena_t& arena){
+  return (arena.samples.size() - arena.freeBlocks.size() * HISTORY_BLOCK) * sizeof(pip_sample_t);
+}
@@ -0,0 +1,230 @@
+/*
+ * Copyright (C) 2014 Robert S. Moore II and Rutgers University
+ * All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA
+ * or visit http://www.gnu.org/licenses/gpl-2.0.html
+ */
+
+/*******************************************************************************
+ * @file pip_replay.cpp
+ * Replays files written by recordSample (recordings and history snapshots)
+ * or raw frame captures into the console.  A replay thread reads the file and pushes the samples
+ * into a ring that the UI thread drains exactly like a receiver's, either
+ * paced by the recorded timestamps (optionally sped up) or as fast as the UI
+ * thread can take them.
+ *
+ * @author Robert S. Moore II
+ ******************************************************************************/
+
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/time.h>
+
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include <pip_replay.hpp>
+#include <pip_util.hpp>
+
+using std::string;
+
+/*
+ * Parses one line in the format written by recordSample.  Empty fields were
+ * not present in the original sample.  Returns false for the header and for
+ * anything else that is not a sample.
+ */
+bool parseSampleLine(const string& line, pip_sample_t& s){
+  std::vector<string> fields;
+  string::size_type start = 0;
+  while(true){
+    string::size_type comma = line.find(',', start);
+    if(comma == string::npos){
+      fields.push_back(line.substr(start));
+      break;
+    }
+    fields.push_back(line.substr(start, comma - start));
+    start = comma + 1;
+  }
+  // Timestamp,Date,Tag ID,Tag ID (Hex),RSSI,Temp,RH,Light,Moisture,Battery (mV),Battery (J)
+  if(fields.size() < 11 or fields[0].empty() or fields[2].empty()){
+    return false;
+  }
+  char* end;
+  long long timestamp = strtoll(fields[0].c_str(), &end, 10);
+  if(*end != '\0'){
+    return false;
+  }
+
+  initPipData(s);
+  s.time.tv_sec = timestamp / 1000;
+  s.time.tv_usec = (timestamp % 1000) * 1000;
+  s.tagID = atoi(fields[2].c_str());
+  s.rssi = atof(fields[4].c_str());
+  s.dropped = 0;
+  s.rcvTime = 0;
+  s.intervalConfidence = 0;
+  if(not fields[5].empty()){
+    s.tempC = atof(fields[5].c_str());
+  }
+  if(not fields[6].empty()){
+    s.rh = atof(fields[6].c_str());
+  }
+  // Light is recorded as a fraction of 0xFF
+  if(not fields[7].empty()){
+    s.light = (int)std::floor(atof(fields[7].c_str()) * 255.0 + 0.5);
+  }
+  if(not fields[8].empty()){
+    s.moisture = atol(fields[8].c_str());
+  }
+  if(not fields[9].empty()){
+    s.batteryMv = atof(fields[9].c_str());
+  }
+  if(not fields[10].empty()){
+    s.batteryJ = atoi(fields[10].c_str());
+  }
+  return true;
+}
+
+/*
+ * Pushes a sample, waiting for room instead of dropping it since a replay
+ * should be lossless.  Returns false if the replay was closed while waiting.
+ */
+static bool pushSample(pip_replay_t* replay, pip_sample_t& s){
+  while(not replay->samples.push(s)){
+    if(replay->closing){
+      return false;
+    }
+    wakePIPs();
+    usleep(100);
+  }
+  ++replay->produced;
+  // The UI thread drains until empty, so only an empty ring needs a wakeup
+  if(1 == replay->samples.size()){
+    wakePIPs();
+  }
+  return true;
+}
+
+/*
+ * Waits until a sample recorded at the given time (ms) is due, relative to
+ * the first sample of the replay.
+ */
+static void waitUntilDue(pip_replay_t* replay, double recorded){
+  if(REPLAY_SPEED_MAX == replay->speed){
+    return;
+  }
+  if(replay->firstSample < 0){
+    replay->firstSample = recorded;
+    replay->firstPlayed = nowMs();
+  }
+  double due = replay->firstPlayed + (recorded - replay->firstSample)/replay->speed;
+  // Sleep in short steps so closing stays responsive
+  for(double now = nowMs(); now < due and not replay->closing; now = nowMs()){
+    usleep((useconds_t)std::min(100000.0, (due - now)*1000.0));
+  }
+}
+
+/*
+ * Plays back a file written by recordSample.
+ */
+static void replayRecording(pip_replay_t* replay){
+  std::ifstream in(replay->filename.c_str());
+  string line;
+  while(not replay->closing and std::getline(in, line)){
+    pip_sample_t s;
+    if(not parseSampleLine(line, s)){
+      // Only the header is expected
+      if(0 != line.compare(0, 9, "Timestamp")){
+        ++replay->skipped;
+      }
+      continue;
+    }
+    waitUntilDue(replay, s.time.tv_sec * 1000.0 + s.time.tv_usec/1000.0);
+    if(not pushSample(replay, s)){
+      break;
+    }
+  }
+}
+
+/*
+ * Plays back a raw capture, decoding the frames straight from the mapped
+ * file.  Frames that do not decode to a good packet count as skipped.
+ */
+static void replayCapture(pip_replay_t* replay){
+  capture_map_t map;
+  if(not mapCapture(replay->filename, map)){
+    return;
+  }
+  for(size_t i = 0; i < map.count and not replay->closing; ++i){
+    const capture_record_t& record = map.records[i];
+    pip_sample_t s;
+    timeval received;
+    received.tv_sec = record.hostTime / 1000000;
+    received.tv_usec = record.hostTime % 1000000;
+    if(not decodeFrame(record.frame, record.length, received, s)){
+      ++replay->skipped;
+      continue;
+    }
+    waitUntilDue(replay, record.hostTime / 1000.0);
+    if(not pushSample(replay, s)){
+      break;
+    }
+  }
+  unmapCapture(map);
+}
+
+/*
+ * Body of the replay thread.
+ */
+static void replayFile(pip_replay_t* replay){
+  replay->firstSample = -1;
+  if(isCaptureFile(replay->filename)){
+    replayCapture(replay);
+  }else {
+    replayRecording(replay);
+  }
+  replay->done = true;
+  wakePIPs();
+}
+
+/*
+ * Starts replaying a file at the given multiple of real time, or as fast as
+ * possible with REPLAY_SPEED_MAX.  Returns NULL if the file cannot be read.
+ */
+pip_replay_t* startReplay(const string& filename, double speed){
+  std::ifstream test(filename.c_str());
+  if(not test){
+    return NULL;
+  }
+  test.close();
+  pip_replay_t* rp = new pip_replay_t();
+  rp->filename = filename;
+  rp->speed = speed;
+  rp->started = nowMs();
+  rp->thread = std::thread(replayFile, rp);
+  return rp;
+}
+
+void stopReplay(pip_replay_t* replay){
+  replay->closing = true;
+  if(replay->thread.joinable()){
+    replay->thread.join();
+  }
+  delete replay;
+}
@@ -0,0 +1,157 @@
+/*
+ * Copyright (C) 2014 Robert S. Moore II and Rutgers University
+ * All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA
+ * or visit http://www.gnu.org/licenses/gpl-2.0.html
+ */
+
+/*******************************************************************************
+ * @file pip_rows.cpp
+ * Cache of the formatted rows of the main list.
+ *
+ * @author Robert S. Moore II
+ ******************************************************************************/
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <ctime>
+
+#include <pip_rows.hpp>
+
+/*
+ * Appends formatted text to the row, drawn in color pair color unless it
+ * is 0.  Text past ROW_WIDTH is cut off.
+ */
+static void addText(tag_row_t& row, short color, const char* format, ...){
+  va_list args;
+  va_start(args, format);
+  int room = ROW_WIDTH - row.length;
+  int written = vsnprintf(row.text + row.length, room, format, args);
+  va_end(args);
+  if(written < 0){
+    return;
+  }
+  if(written >= room){
+    written = room - 1;
+  }
+  if(0 != color and row.numSpans < ROW_SPANS){
+    row_span_t& span = row.spans[row.numSpans++];
+    span.start = row.length;
+    span.end = row.length + written;
+    span.color = color;
+  }
+  row.length += written;
+}
+
+/*
+ * Formats the row of a sample, with the same fields and colors the main
+ * list has always had.
+ */
+static void formatRow(tag_row_t& row, const pip_sample_t& pkt){
+  row.length = 0;
+  row.numSpans = 0;
+  snprintf(row.decimalID, ROW_ID_WIDTH, "%04d  ", pkt.tagID);
+  snprintf(row.hexID, ROW_ID_WIDTH, "%04x  ", pkt.tagID);
+
+  short color = COLOR_RSSI_MED;
+  if(pkt.rssi < -90.0){
+    color = COLOR_RSSI_LOW;
+  }else if(pkt.rssi > -60.0){
+    color = COLOR_RSSI_HIGH;
+  }
+  addText(row, color, "%4.1f", pkt.rssi);
+
+  if(pkt.tempC > -300){
+    addText(row, 0, " %6.2f C", pkt.tempC);
+  }else{
+    addText(row, 0, " ------  ");
+  }
+  if(pkt.rh > -300){
+    addText(row, 0, " %6.2f %% ", pkt.rh);
+  }else {
+    addText(row, 0, " ------   ");
+  }
+  if(pkt.light >= 0){
+    color = COLOR_LIGHT_MED;
+    if(pkt.light < 0x40){
+      color = COLOR_LIGHT_LOW;
+    }else if(pkt.light > 0xB0){
+      color = COLOR_LIGHT_HIGH;
+    }
+    addText(row, color, "%02x", pkt.light);
+  }else {
+    addText(row, 0, "--");
+  }
+
+  if(pkt.moisture >= 0){
+    addText(row, 0, " %4d", (int)pkt.moisture);
+  }else {
+    addText(row, 0, " ----");
+  }
+
+  // Battery
+  addText(row, 0, "  ");
+  if(pkt.batteryMv > 0){
+    color = pkt.batteryMv > 2.9 ? COLOR_BATTERY_NORMAL : COLOR_BATTERY_LOW;
+    addText(row, color, "%4.3f", pkt.batteryMv);
+    addText(row, 0, " ");
+    addText(row, color, "%4d", pkt.batteryJ);
+  }else {
+    addText(row, 0, "----- ----");
+  }
+
+  //2014-12-02 13:34:04
+  char buffer[20];
+  strftime(buffer, 20, DATE_TIME_FORMAT, std::localtime(&pkt.time.tv_sec));
+  addText(row, 0, "  %s  ", buffer);
+
+  // Interval
+  color = pkt.intervalConfidence > 0.5 ? (pkt.intervalConfidence > 0.95 ? COLOR_CONFIDENCE_HIGH : COLOR_CONFIDENCE_MED) : COLOR_CONFIDENCE_LOW;
+  addText(row, color, "%6ld", pkt.interval);
+  row.valid = true;
+}
+
+/*
+ * Marks the row of the tag in slot to be formatted again, as when its
+ * sample changed.
+ */
+void invalidateRow(row_cache_t& cache, int slot){
+  if((size_t)slot < cache.rows.size()){
+    cache.rows[slot].valid = false;
+  }
+}
+
+/*
+ * Marks every row to be formatted again.
+ */
+void clearRows(row_cache_t& cache){
+  cache.rows.clear();
+}
+
+/*
+ * Returns the row of the tag in slot, formatting it from sample if it
+ * changed since it was last formatted.
+ */
+const tag_row_t& formattedRow(row_cache_t& cache, int slot, const pip_sample_t& sample){
+  if(cache.rows.size() <= (size_t)slot){
+    cache.rows.resize(slot + 1);
+  }
+  tag_row_t& row = cache.rows[slot];
+  if(not row.valid){
+    formatRow(row, sample);
+  }
+  return row;
+}
@@ -0,0 +1,343 @@
+/*
+ * Copyright (C) 2014 Robert S. Moore II and Rutgers University
+ * All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA
+ * or visit http://www.gnu.org/licenses/gpl-2.0.html
+ */
+
+/*******************************************************************************
+ * @file pip_sim.cpp
+ * Simulated receivers.  Each one has an acquisition thread that builds the
+ * frames a PIP would return for its share of the tags, at the times the tags
+ * would broadcast, and hands them to handleFrame exactly as a real
+ * receiver's reads are.  Everything downstream (capture, decoding, the
+ * sample ring and the UI thread) cannot tell the difference.
+ *
+ * @author Robert S. Moore II
+ ******************************************************************************/
+
+#include <arpa/inet.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cmath>
+#include <functional>
+#include <queue>
+#include <random>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <pip_sim.hpp>
+#include <pip_util.hpp>
+
+using std::list;
+using std::string;
+
+/*
+ * State of one simulated tag.  Sensor values wander a little with every
+ * broadcast.
+ */
+typedef struct {
+  unsigned int id;
+  double period;
+  double rssi;
+  double tempC;
+  double rh;
+  double light;
+  double moisture;
+  double batteryMv;
+  double batteryJ;
+} sim_tag_t;
+
+void defaultSimConfig(pip_sim_config_t& config){
+  config.tags = 1000;
+  config.receivers = 1;
+  config.firstID = 1;
+  config.period = 1000.0;
+  config.spread = 0.1;
+  config.rssiMean = -70.0;
+  config.rssiDeviation = 8.0;
+  config.sensors = SENSOR_TEMP_RH | SENSOR_LIGHT | SENSOR_BATTERY;
+  config.seed = 1;
+}
+
+/*
+ * Bytes of extra data (including the header byte) a tag sending the given
+ * sensor header bits puts in each packet.  Returns -1 for bits the decoder
+ * does not know.
+ */
+int simDataLength(unsigned char sensors){
+  if(0 == sensors){
+    return 0;
+  }
+  if(sensors & 0x80){
+    return -1;
+  }
+  return sensorDataLength(sensors);
+}
+
+/*
+ * Parses a simulation description of the form
+ *   tags=50000,period=1000,spread=0.1,rssi=-70,rssidev=8,sensors=0x4c,receivers=2
+ * Every field is optional and a bare number is taken as the tag count.
+ * Returns false if anything is unknown or out of range.
+ */
+bool parseSimConfig(const string& spec, pip_sim_config_t& config){
+  defaultSimConfig(config);
+  string::size_type start = 0;
+  while(start < spec.size()){
+    string::size_type comma = spec.find(',', start);
+    if(comma == string::npos){
+      comma = spec.size();
+    }
+    string field = spec.substr(start, comma - start);
+    start = comma + 1;
+    string::size_type eq = field.find('=');
+    string key = (eq == string::npos) ? "tags" : field.substr(0, eq);
+    string value = (eq == string::npos) ? field : field.substr(eq + 1);
+    char* end;
+    double number = strtod(value.c_str(), &end);
+    if(key == "sensors"){
+      number = strtol(value.c_str(), &end, 0);
+    }
+    if(value.empty() or *end != '\0'){
+      return false;
+    }
+    if(key == "tags"){
+      config.tags = (int)number;
+    }
+    else if(key == "receivers"){
+      config.receivers = (int)number;
+    }
+    else if(key == "first"){
+      config.firstID = (unsigned int)number;
+    }
+    else if(key == "period"){
+      config.period = number;
+    }
+    else if(key == "spread"){
+      config.spread = number;
+    }
+    else if(key == "rssi"){
+      config.rssiMean = number;
+    }
+    else if(key == "rssidev"){
+      config.rssiDeviation = number;
+    }
+    else if(key == "sensors"){
+      if(number < 0 or number > 0xFF){
+        return false;
+      }
+      config.sensors = (unsigned char)number;
+    }
+    else if(key == "seed"){
+      config.seed = (unsigned int)number;
+    }
+    else {
+      return false;
+    }
+  }
+  //Tag IDs are 24 bits and the extra data must fit in one packet
+  int dataLength = simDataLength(config.sensors);
+  return 0 < config.tags and SIM_MAX_TAGS >= config.tags and
+    0 < config.receivers and SIM_MAX_RECEIVERS >= config.receivers and
+    config.receivers <= config.tags and
+    config.firstID + config.tags <= 0x1000000 and
+    SIM_MIN_PERIOD <= config.period and
+    0 <= config.spread and 1 > config.spread and
+    0 <= config.rssiDeviation and
+    0 <= dataLength and PACKET_EXTRA_LEN >= dataLength;
+}
+
+/*
+ * Writes a value in the decoder's 16ths format.  Negative values cannot be
+ * represented.
+ */
+static unsigned char* putSixteenths(unsigned char* data, double value){
+  value = std::max(0.0, std::min(value, 4095.0));
+  int whole = (int)(value / 16.0);
+  data[0] = whole;
+  data[1] = (unsigned char)std::min(255.0, (value - whole * 16.0) * 16.0);
+  return data + 2;
+}
+
+static unsigned char* putShort(unsigned char* data, double value){
+  unsigned int v = (unsigned int)std::max(0.0, std::min(value, 65535.0));
+  data[0] = v >> 8;
+  data[1] = v & 0xFF;
+  return data + 2;
+}
+
+/*
+ * Builds the extra data for a tag's packet.  Returns its length.
+ */
+static int putSensorData(unsigned char* data, unsigned char sensors, const sim_tag_t& tag){
+  if(0 == sensors){
+    return 0;
+  }
+  unsigned char* d = data;
+  *d++ = sensors;
+  if(sensors & SENSOR_BINARY){
+    *d++ = (unsigned char)(std::max(0, std::min((int)tag.tempC + 40, 127)) << 1);
+  }
+  if(sensors & SENSOR_TEMP){
+    d = putSixteenths(d, tag.tempC);
+  }
+  if(sensors & SENSOR_LIGHT){
+    *d++ = (unsigned char)tag.light;
+  }
+  if(sensors & SENSOR_TEMP_RH){
+    d = putSixteenths(d, tag.tempC);
+    d = putSixteenths(d, tag.rh);
+  }
+  if(sensors & SENSOR_MOISTURE){
+    d = putShort(d, tag.moisture);
+  }
+  if(sensors & SENSOR_HISTORY){
+    memset(d, 0, 6);
+    d += 6;
+  }
+  if(sensors & SENSOR_BATTERY){
+    d = putShort(d, tag.batteryMv);
+    d = putShort(d, tag.batteryJ);
+  }
+  return d - data;
+}
+
+/*
+ * Builds the frame a PIP would return for one broadcast of the tag into
+ * buf+1, the same place a real read lands.  Returns the bytes "received".
+ */
+static int buildFrame(pip_receiver_t* rcv, unsigned char* buf, const sim_tag_t& tag,
+    double rssi, unsigned char sensors, double now){
+  unsigned char* frame = buf + 1;
+  //Dropped packet count
+  frame[0] = 0;
+  //Basestation ID
+  frame[1] = (rcv->deviceNum >> 16) & 0xFF;
+  frame[2] = (rcv->deviceNum >> 8) & 0xFF;
+  frame[3] = rcv->deviceNum & 0xFF;
+  //Receiver timestamp in quarter microseconds, network byte order.  It wraps
+  //like the receiver's counter; a double too large for uint32_t has no
+  //defined conversion, so it goes through uint64_t.
+  uint32_t time = htonl((uint32_t)(uint64_t)(now * 4000.0));
+  memcpy(frame + 4, &time, 4);
+  frame[8] = (tag.id >> 16) & 0xFF;
+  frame[9] = (tag.id >> 8) & 0xFF;
+  frame[10] = tag.id & 0xFF;
+  //Inverse of the DN505 conversion in decodeFrame.  Zero marks a bad packet.
+  int raw = (int)std::floor((rssi + RSSI_OFFSET) * 2.0 + 0.5);
+  raw = std::max(-128, std::min(raw, 127));
+  frame[11] = (0 == raw) ? 1 : (unsigned char)(raw & 0xFF);
+  //Link quality in the low 7 bits, CRC ok in the top bit
+  frame[12] = 0x80 | 0x7F;
+  return PACKET_LEN + putSensorData(frame + PACKET_LEN, sensors, tag);
+}
+
+/*
+ * Moves the tag's sensor values a small random step.
+ */
+static void wander(sim_tag_t& tag, std::mt19937& rng){
+  std::uniform_real_distribution<double> step(-1.0, 1.0);
+  tag.tempC = std::max(0.0, std::min(tag.tempC + 0.1 * step(rng), 60.0));
+  tag.rh = std::max(0.0, std::min(tag.rh + 0.2 * step(rng), 100.0));
+  tag.light = std::max(0.0, std::min(tag.light + 4.0 * step(rng), 255.0));
+  tag.moisture = std::max(0.0, std::min(tag.moisture + 5.0 * step(rng), 65535.0));
+  tag.batteryMv = std::max(2000.0, tag.batteryMv - 0.01);
+  tag.batteryJ += 0.01;
+}
+
+/*
+ * Body of a simulated receiver's acquisition thread.  Tags are kept in a heap
+ * ordered by their next broadcast, and every tag that is due is sent before
+ * the thread sleeps until the next one.
+ */
+static void simulate(pip_receiver_t* rcv, pip_sim_config_t config, unsigned int firstID, int count){
+  std::mt19937 rng(config.seed + rcv->deviceNum);
+  std::uniform_real_distribution<double> unit(0.0, 1.0);
+  std::normal_distribution<double> tagRssi(config.rssiMean, config.rssiDeviation);
+  std::normal_distribution<double> noise(0.0, SIM_RSSI_NOISE);
+
+  std::vector<sim_tag_t> tags(count);
+  typedef std::pair<double, int> due_t;
+  std::priority_queue<due_t, std::vector<due_t>, std::greater<due_t> > schedule;
+  double start = nowMs();
+  for(int i = 0; i < count; ++i){
+    sim_tag_t& tag = tags[i];
+    tag.id = firstID + i;
+    tag.period = config.period * (1.0 + config.spread * (2.0 * unit(rng) - 1.0));
+    tag.rssi = tagRssi(rng);
+    tag.tempC = 18.0 + 8.0 * unit(rng);
+    tag.rh = 30.0 + 30.0 * unit(rng);
+    tag.light = 255.0 * unit(rng);
+    tag.moisture = 1000.0 * unit(rng);
+    tag.batteryMv = 2800.0 + 400.0 * unit(rng);
+    tag.batteryJ = 0;
+    //Spread the first broadcasts over one period
+    schedule.push(due_t(start + tag.period * unit(rng), i));
+  }
+
+  unsigned char* buf = rcv->framePool[0];
+  while(not rcv->closing){
+    double now = nowMs();
+    while(schedule.top().first <= now and not rcv->closing){
+      due_t next = schedule.top();
+      schedule.pop();
+      sim_tag_t& tag = tags[next.second];
+      wander(tag, rng);
+      int transferred = buildFrame(rcv, buf, tag, tag.rssi + noise(rng), config.sensors, now);
+      handleFrame(rcv, buf, transferred);
+      schedule.push(due_t(next.first + tag.period, next.second));
+    }
+    //Tags due in the next pass are a new batch
+    rcv->batchTimed = false;
+    if(rcv->pushed){
+      rcv->pushed = false;
+      wakePIPs();
+    }
+    //Sleep until the next broadcast, but never so long that closing is missed
+    double wait = std::min(schedule.top().first - nowMs(), (double)PIP_TRANSFER_TIMEOUT);
+    if(wait > 0){
+      usleep((useconds_t)(wait * 1000.0));
+    }
+  }
+  wakePIPs();
+}
+
+/*
+ * Creates the simulated receivers and adds them to pip_devs.  They are
+ * closed with closePIP like any other receiver.
+ */
+void startSimulation(list<pip_receiver_t*>& pip_devs, const pip_sim_config_t& config){
+  unsigned int firstID = config.firstID;
+  for(int r = 0; r < config.receivers; ++r){
+    //Hand out the remainder one tag at a time
+    int count = config.tags / config.receivers + (r < config.tags % config.receivers ? 1 : 0);
+    pip_receiver_t* rcv = new pip_receiver_t();
+    rcv->ctx = NULL;
+    rcv->handle = NULL;
+    rcv->deviceNum = SIM_DEVICE_BASE + r;
+    rcv->version = GPIP;
+    rcv->state = PIP_STATE_ACTIVE;
+    rcv->announced = true;
+    rcv->thread = std::thread(simulate, rcv, config, firstID, count);
+    pip_devs.push_back(rcv);
+    firstID += count;
+  }
+}
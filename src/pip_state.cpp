@@ -0,0 +1,432 @@
+/*
+ * Copyright (C) 2014 Robert S. Moore II and Rutgers University
+ * All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA
+ * or visit http://www.gnu.org/licenses/gpl-2.0.html
+ */
+
+/*******************************************************************************
+ * @file pip_state.cpp
+ * Memory-mapped checkpoints of the console state.
+ *
+ * @author Robert S. Moore II
+ ******************************************************************************/
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <utility>
+
+#include <pip_state.hpp>
+#include <pip_writer.hpp>
+
+using std::string;
+using std::vector;
+
+/* Size of an element of each section */
+static const size_t sectionSizes[STATE_SECTIONS] = {
+  sizeof(pip_sample_t),           // STATE_SAMPLES
+  sizeof(int),                    // STATE_FREE_SLOTS
+  sizeof(history_ring_t),         // STATE_RINGS
+  sizeof(pip_sample_t),           // STATE_ARENA
+  sizeof(int),                    // STATE_FREE_BLOCKS
+  sizeof(int),                    // STATE_NEWER
+  sizeof(int),                    // STATE_OLDER
+  sizeof(state_archive_tag_t),    // STATE_ARCHIVE_TAGS
+  sizeof(state_archive_block_t),  // STATE_ARCHIVE_BLOCKS
+  1                               // STATE_ARCHIVE_BYTES
+};
+
+/*
+ * Places a section of count elements at end, keeping every section 8 byte
+ * aligned so that it can be used where it is mapped.
+ */
+static void placeSection(state_header_t& header, uint64_t& end, int section, size_t count){
+  header.sections[section].offset = end;
+  header.sections[section].count = count;
+  end += (count * sectionSizes[section] + 7) & ~(uint64_t)7;
+}
+
+template<typename T>
+static void putSection(unsigned char* base, const state_header_t& header, int section,
+    const vector<T>& data){
+  if(not data.empty()){
+    memcpy(base + header.sections[section].offset, data.data(), data.size() * sizeof(T));
+  }
+}
+
+template<typename T>
+static void getSection(const unsigned char* base, const state_header_t& header, int section,
+    vector<T>& data){
+  data.resize(header.sections[section].count);
+  if(not data.empty()){
+    memcpy(data.data(), base + header.sections[section].offset, data.size() * sizeof(T));
+  }
+}
+
+/*
+ * Lays the console state out in image exactly as a state file holds it.
+ * The image is filled on the calling thread, so that the state can go on
+ * changing while the image is written.
+ */
+void stateImage(const tag_table_t& table, const history_arena_t& arena, const archive_t& archive,
+    const tag_aging_t& aging, vector<unsigned char>& image){
+  state_header_t header;
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, STATE_MAGIC, sizeof(header.magic));
+  header.version = STATE_VERSION;
+  header.byteOrder = STATE_BYTE_ORDER;
+  header.sampleSize = sizeof(pip_sample_t);
+  header.historyBlock = HISTORY_BLOCK;
+  header.historyBlocks = HISTORY_BLOCKS;
+  header.archiveBlock = ARCHIVE_BLOCK;
+  header.archiveColumns = ARCHIVE_COLUMNS;
+  header.now = aging.now;
+  header.expired = aging.expired;
+  header.evicted = aging.evicted;
+  header.archiveSamples = archive.samples;
+  header.archiveBytes = archive.bytes;
+
+  //The archive is the only state not already in flat arrays
+  vector<state_archive_tag_t> archiveTags(archive.tags.size());
+  vector<state_archive_block_t> archiveBlocks;
+  size_t archiveBytes = 0;
+  for(size_t t = 0; t < archive.tags.size(); ++t){
+    const archive_tag_t& tag = archive.tags[t];
+    state_archive_tag_t& saved = archiveTags[t];
+    memset(&saved, 0, sizeof(saved));
+    saved.tagID = tag.tagID;
+    saved.sealed = tag.sealed.size();
+    for(size_t b = 0; b < tag.sealed.size(); ++b){
+      state_archive_block_t block;
+      block.firstTime = tag.sealed[b].firstTime;
+      memcpy(block.end, tag.sealed[b].end, sizeof(block.end));
+      archiveBlocks.push_back(block);
+      archiveBytes += tag.sealed[b].data.size();
+    }
+    for(int c = 0; c < ARCHIVE_COLUMNS; ++c){
+      saved.open[c] = tag.open[c].size();
+      archiveBytes += tag.open[c].size();
+    }
+    saved.openFirst = tag.openFirst;
+    saved.openCount = tag.openCount;
+    saved.runLength = tag.runLength;
+    saved.state = tag.state;
+    saved.runBits = tag.runBits;
+  }
+
+  uint64_t end = (sizeof(header) + 7) & ~(uint64_t)7;
+  placeSection(header, end, STATE_SAMPLES, table.samples.size());
+  placeSection(header, end, STATE_FREE_SLOTS, table.freeSlots.size());
+  placeSection(header, end, STATE_RINGS, arena.rings.size());
+  placeSection(header, end, STATE_ARENA, arena.samples.size());
+  placeSection(header, end, STATE_FREE_BLOCKS, arena.freeBlocks.size());
+  placeSection(header, end, STATE_NEWER, aging.newer.size());
+  placeSection(header, end, STATE_OLDER, aging.older.size());
+  placeSection(header, end, STATE_ARCHIVE_TAGS, archiveTags.size());
+  placeSection(header, end, STATE_ARCHIVE_BLOCKS, archiveBlocks.size());
+  placeSection(header, end, STATE_ARCHIVE_BYTES, archiveBytes);
+
+  //Padding between sections is zeroed, so the same state is the same file
+  image.assign(end, 0);
+  unsigned char* base = image.data();
+  memcpy(base, &header, sizeof(header));
+  putSection(base, header, STATE_SAMPLES, table.samples);
+  putSection(base, header, STATE_FREE_SLOTS, table.freeSlots);
+  putSection(base, header, STATE_RINGS, arena.rings);
+  putSection(base, header, STATE_ARENA, arena.samples);
+  putSection(base, header, STATE_FREE_BLOCKS, arena.freeBlocks);
+  putSection(base, header, STATE_NEWER, aging.newer);
+  putSection(base, header, STATE_OLDER, aging.older);
+  putSection(base, header, STATE_ARCHIVE_TAGS, archiveTags);
+  putSection(base, header, STATE_ARCHIVE_BLOCKS, archiveBlocks);
+  unsigned char* bytes = base + header.sections[STATE_ARCHIVE_BYTES].offset;
+  for(size_t t = 0; t < archive.tags.size(); ++t){
+    const archive_tag_t& tag = archive.tags[t];
+    for(size_t b = 0; b < tag.sealed.size(); ++b){
+      memcpy(bytes, tag.sealed[b].data.data(), tag.sealed[b].data.size());
+      bytes += tag.sealed[b].data.size();
+    }
+    for(int c = 0; c < ARCHIVE_COLUMNS; ++c){
+      if(not tag.open[c].empty()){
+        memcpy(bytes, tag.open[c].data(), tag.open[c].size());
+        bytes += tag.open[c].size();
+      }
+    }
+  }
+}
+
+/*
+ * Writes the console state to path.  Returns false if the state could not
+ * be written, leaving path as it was.
+ */
+bool saveState(const string& path, const tag_table_t& table, const history_arena_t& arena,
+    const archive_t& archive, const tag_aging_t& aging){
+  vector<unsigned char> image;
+  stateImage(table, arena, archive, aging, image);
+  return writeFile(path, image);
+}
+
+/*
+ * True if the recency list is one circle through slot 0, each link matched
+ * by the link back, and every other slot is either on it or unlisted.
+ */
+static bool validRecency(const vector<int>& newer, const vector<int>& older){
+  if(newer.empty()){
+    return true;
+  }
+  size_t listed = 0;
+  for(size_t slot = 0; slot < newer.size(); ++slot){
+    if((-1 == newer[slot]) != (-1 == older[slot])){
+      return false;
+    }
+    if(-1 != newer[slot]){
+      ++listed;
+    }
+  }
+  size_t walked = 0;
+  int slot = 0;
+  do {
+    int next = newer[slot];
+    if(-1 == next or older[next] != slot or listed < ++walked){
+      return false;
+    }
+    slot = next;
+  } while(0 != slot);
+  return walked == listed;
+}
+
+/*
+ * True if every index in a list of slots is a slot, or -1 where allowed.
+ */
+static bool validSlots(const vector<int>& list, size_t slots, int lowest){
+  for(size_t i = 0; i < list.size(); ++i){
+    if(lowest > list[i] or slots <= (size_t)list[i]){
+      return false;
+    }
+  }
+  return true;
+}
+
+/*
+ * Copies the state out of a mapped state file.  Indices are checked before
+ * anything is replaced, a damaged file leaves the state as it was.
+ */
+static int restoreState(const unsigned char* base, size_t size, tag_table_t& table,
+    history_arena_t& arena, archive_t& archive, tag_aging_t& aging){
+  state_header_t header;
+  memcpy(&header, base, sizeof(header));
+  if(sizeof(pip_sample_t) != header.sampleSize or
+      HISTORY_BLOCK != header.historyBlock or HISTORY_BLOCKS != header.historyBlocks or
+      ARCHIVE_BLOCK != header.archiveBlock or ARCHIVE_COLUMNS != header.archiveColumns){
+    return STATE_INCOMPATIBLE;
+  }
+  for(int s = 0; s < STATE_SECTIONS; ++s){
+    const state_section_t& section = header.sections[s];
+    if(section.offset > size or section.count > (size - section.offset) / sectionSizes[s]){
+      return STATE_DAMAGED;
+    }
+  }
+
+  tag_table_t restored;
+  getSection(base, header, STATE_SAMPLES, restored.samples);
+  getSection(base, header, STATE_FREE_SLOTS, restored.freeSlots);
+  size_t slots = restored.samples.size();
+  if(not validSlots(restored.freeSlots, slots, 1)){
+    return STATE_DAMAGED;
+  }
+  //Slot 0 is never used, and every slot not free holds a different tag
+  vector<bool> unused(slots, false);
+  if(0 < slots){
+    unused[0] = true;
+  }
+  for(size_t i = 0; i < restored.freeSlots.size(); ++i){
+    unused[restored.freeSlots[i]] = true;
+  }
+  for(size_t slot = 1; slot < slots; ++slot){
+    if(not unused[slot] and
+        not restored.slots.insert(std::make_pair(restored.samples[slot].tagID, (int)slot)).second){
+      return STATE_DAMAGED;
+    }
+  }
+
+  history_arena_t history;
+  getSection(base, header, STATE_RINGS, history.rings);
+  getSection(base, header, STATE_ARENA, history.samples);
+  getSection(base, header, STATE_FREE_BLOCKS, history.freeBlocks);
+  size_t blocks = history.samples.size() / HISTORY_BLOCK;
+  if(not validSlots(history.freeBlocks, blocks, 0) or slots < history.rings.size()){
+    return STATE_DAMAGED;
+  }
+  //No block is free and in a ring, or in two rings
+  vector<bool> owned(blocks, false);
+  for(size_t i = 0; i < history.freeBlocks.size(); ++i){
+    if(owned[history.freeBlocks[i]]){
+      return STATE_DAMAGED;
+    }
+    owned[history.freeBlocks[i]] = true;
+  }
+  for(size_t r = 0; r < history.rings.size(); ++r){
+    const history_ring_t& ring = history.rings[r];
+    if(0 > ring.numBlocks or HISTORY_BLOCKS < ring.numBlocks or
+        0 > ring.start or HISTORY_DEPTH <= ring.start or
+        0 > ring.count or ring.numBlocks * HISTORY_BLOCK < ring.count){
+      return STATE_DAMAGED;
+    }
+    for(int b = 0; b < ring.numBlocks; ++b){
+      if(0 > ring.blocks[b] or blocks <= (size_t)ring.blocks[b] or owned[ring.blocks[b]]){
+        return STATE_DAMAGED;
+      }
+      owned[ring.blocks[b]] = true;
+    }
+  }
+
+  vector<int> newer;
+  vector<int> older;
+  getSection(base, header, STATE_NEWER, newer);
+  getSection(base, header, STATE_OLDER, older);
+  if(newer.size() != older.size() or slots < newer.size() or
+      not validSlots(newer, newer.size(), -1) or not validSlots(older, older.size(), -1) or
+      not validRecency(newer, older)){
+    return STATE_DAMAGED;
+  }
+
+  vector<state_archive_tag_t> archiveTags;
+  vector<state_archive_block_t> archiveBlocks;
+  getSection(base, header, STATE_ARCHIVE_TAGS, archiveTags);
+  getSection(base, header, STATE_ARCHIVE_BLOCKS, archiveBlocks);
+  if(slots < archiveTags.size()){
+    return STATE_DAMAGED;
+  }
+  const unsigned char* bytes = base + header.sections[STATE_ARCHIVE_BYTES].offset;
+  const unsigned char* bytesEnd = bytes + header.sections[STATE_ARCHIVE_BYTES].count;
+  size_t nextBlock = 0;
+  archive_t longTerm = archive_t();
+  longTerm.tags.resize(archiveTags.size());
+  for(size_t t = 0; t < archiveTags.size(); ++t){
+    const state_archive_tag_t& saved = archiveTags[t];
+    archive_tag_t& tag = longTerm.tags[t];
+    if(archiveBlocks.size() - nextBlock < saved.sealed or
+        0 > saved.openCount or ARCHIVE_BLOCK <= saved.openCount or
+        0 > saved.runLength or saved.openCount < saved.runLength){
+      return STATE_DAMAGED;
+    }
+    tag.tagID = saved.tagID;
+    tag.sealed.resize(saved.sealed);
+    for(size_t b = 0; b < saved.sealed; ++b){
+      const state_archive_block_t& block = archiveBlocks[nextBlock++];
+      size_t length = block.end[ARCHIVE_COLUMNS-1];
+      if((size_t)(bytesEnd - bytes) < length){
+        return STATE_DAMAGED;
+      }
+      for(int c = 1; c < ARCHIVE_COLUMNS; ++c){
+        if(block.end[c-1] > block.end[c]){
+          return STATE_DAMAGED;
+        }
+      }
+      tag.sealed[b].firstTime = block.firstTime;
+      memcpy(tag.sealed[b].end, block.end, sizeof(block.end));
+      tag.sealed[b].data.assign(bytes, bytes + length);
+      bytes += length;
+    }
+    for(int c = 0; c < ARCHIVE_COLUMNS; ++c){
+      if((size_t)(bytesEnd - bytes) < saved.open[c]){
+        return STATE_DAMAGED;
+      }
+      tag.open[c].assign(bytes, bytes + saved.open[c]);
+      bytes += saved.open[c];
+    }
+    tag.openFirst = saved.openFirst;
+    tag.openCount = saved.openCount;
+    tag.runLength = saved.runLength;
+    tag.state = saved.state;
+    tag.runBits = saved.runBits;
+    //The columns are only walked when a sample is asked for, so each block
+    //is decoded once here to know that every one of them can be
+    if(not validArchive(longTerm, t)){
+      return STATE_DAMAGED;
+    }
+  }
+  longTerm.samples = header.archiveSamples;
+  longTerm.bytes = header.archiveBytes;
+
+  //The orders of the main list are rebuilt from the slots in use
+  restored.sort = table.sort;
+  rebuildSortOrders(restored);
+
+  std::swap(table, restored);
+  std::swap(arena, history);
+  std::swap(archive, longTerm);
+  aging.newer.swap(newer);
+  aging.older.swap(older);
+  aging.now = header.now;
+  aging.expired = header.expired;
+  aging.evicted = header.evicted;
+  //The expiry order depends on the policy this run was started with
+  aging.byDeadline.root = 0;
+  aging.byDeadline.nodes.clear();
+  for(size_t slot = 1; slot < slots; ++slot){
+    if(not unused[slot]){
+      agingSchedule(aging, table, slot);
+    }
+  }
+  return STATE_LOADED;
+}
+
+/*
+ * Replaces the console state with the state saved in path.  Returns
+ * STATE_LOADED, STATE_MISSING if there is no such file, STATE_INCOMPATIBLE
+ * if it was written with another layout, or STATE_DAMAGED if it cannot be
+ * used otherwise.  Only STATE_LOADED changes the state.
+ */
+int loadState(const string& path, tag_table_t& table, history_arena_t& arena,
+    archive_t& archive, tag_aging_t& aging){
+  int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if(0 > fd){
+    return ENOENT == errno ? STATE_MISSING : STATE_DAMAGED;
+  }
+  struct stat st;
+  if(0 != fstat(fd, &st) or (size_t)st.st_size < sizeof(state_header_t)){
+    close(fd);
+    return STATE_DAMAGED;
+  }
+  size_t size = st.st_size;
+  void* map = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if(MAP_FAILED == map){
+    return STATE_DAMAGED;
+  }
+  madvise(map, size, MADV_SEQUENTIAL);
+
+  const unsigned char* base = (const unsigned char*)map;
+  const state_header_t* header = (const state_header_t*)base;
+  int result;
+  if(0 != memcmp(header->magic, STATE_MAGIC, sizeof(header->magic))){
+    result = STATE_DAMAGED;
+  }
+  else if(STATE_VERSION != header->version or STATE_BYTE_ORDER != header->byteOrder){
+    result = STATE_INCOMPATIBLE;
+  }
+  else {
+    result = restoreState(base, size, table, arena, archive, aging);
+  }
+  munmap(map, size);
+  return result;
+}
@@ -0,0 +1,188 @@
+/*
+ * Copyright (C) 2014 Robert S. Moore II and Rutgers University
+ * All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA
+ * or visit http://www.gnu.org/licenses/gpl-2.0.html
+ */
+
+/*******************************************************************************
+ * @file pip_stream.cpp
+ * Formats samples straight into a large buffer that is written out in one
+ * call when it fills up, so streaming costs a few formatting calls per
+ * sample and one write per buffer.
+ *
+ * @author Robert S. Moore II
+ ******************************************************************************/
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <string>
+
+#include <pip_stream.hpp>
+#include <pip_util.hpp>
+
+using std::string;
+
+//The stream being written, if any
+static int streamFd = -1;
+static bool streamOwnsFd = false;
+static int streamFormat = STREAM_TEXT;
+static bool streamFailed = false;
+static char* streamBuffer = NULL;
+static size_t streamUsed = 0;
+
+/*
+ * Longest text line a sample can produce, so a line is never split between
+ * two writes.
+ */
+#define STREAM_LINE_MAX 160
+
+/*
+ * Starts streaming in the given format.  The destination is a file name,
+ * "-" for standard output, or "fd:<n>" for a descriptor that is already
+ * open.  Files are truncated.
+ */
+bool openStream(const string& destination, int format){
+  closeStream();
+  if(destination == "-"){
+    streamFd = STDOUT_FILENO;
+    streamOwnsFd = false;
+  }
+  else if(0 == destination.compare(0, 3, "fd:")){
+    char* end;
+    long fd = strtol(destination.c_str() + 3, &end, 10);
+    if(*end != '\0' or fd < 0 or 0 > fcntl(fd, F_GETFD)){
+      return false;
+    }
+    streamFd = fd;
+    streamOwnsFd = false;
+  }
+  else {
+    streamFd = open(destination.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if(0 > streamFd){
+      return false;
+    }
+    streamOwnsFd = true;
+  }
+  streamFormat = format;
+  streamFailed = false;
+  streamBuffer = new char[STREAM_BUFFER_SIZE];
+  streamUsed = 0;
+  if(STREAM_BINARY == format){
+    stream_header_t header;
+    memcpy(header.magic, STREAM_MAGIC, sizeof(header.magic));
+    header.version = STREAM_VERSION;
+    header.recordSize = sizeof(stream_record_t);
+    memcpy(streamBuffer, &header, sizeof(header));
+    streamUsed = sizeof(header);
+  }
+  return true;
+}
+
+/*
+ * Formats one sample as a text line at buff, returning its length.  The
+ * time is in milliseconds, see pip_stream.hpp.
+ */
+static int formatSample(char* buff, const pip_sample_t& s){
+  int length = snprintf(buff, STREAM_LINE_MAX, "%ld%03ld,%d,%.1f,",
+      (long)s.time.tv_sec, (long)s.time.tv_usec/1000, s.tagID, s.rssi);
+  if(s.tempC > -299){
+    length += snprintf(buff+length, STREAM_LINE_MAX-length, "%.2f", s.tempC);
+  }
+  buff[length++] = ',';
+  if(s.rh > -299){
+    length += snprintf(buff+length, STREAM_LINE_MAX-length, "%.2f", s.rh);
+  }
+  buff[length++] = ',';
+  if(s.light >= 0){
+    length += snprintf(buff+length, STREAM_LINE_MAX-length, "%d", s.light);
+  }
+  buff[length++] = ',';
+  if(s.moisture >= 0){
+    length += snprintf(buff+length, STREAM_LINE_MAX-length, "%ld", s.moisture);
+  }
+  buff[length++] = ',';
+  if(s.batteryMv >= 0){
+    length += snprintf(buff+length, STREAM_LINE_MAX-length, "%.3f", s.batteryMv);
+  }
+  buff[length++] = ',';
+  if(s.batteryJ >= 0){
+    length += snprintf(buff+length, STREAM_LINE_MAX-length, "%d", s.batteryJ);
+  }
+  buff[length++] = '\n';
+  return length;
+}
+
+void streamSample(const pip_sample_t& s){
+  if(0 > streamFd or streamFailed){
+    return;
+  }
+  if(STREAM_BINARY == streamFormat){
+    if(streamUsed + sizeof(stream_record_t) > STREAM_BUFFER_SIZE){
+      flushStream();
+    }
+    stream_record_t record;
+    record.time = (uint64_t)s.time.tv_sec * 1000000 + s.time.tv_usec;
+    record.tagID = s.tagID;
+    record.rssi = s.rssi;
+    record.tempC = s.tempC;
+    record.rh = s.rh;
+    record.batteryMv = s.batteryMv;
+    record.light = s.light;
+    record.moisture = s.moisture;
+    record.batteryJ = s.batteryJ;
+    memcpy(streamBuffer + streamUsed, &record, sizeof(record));
+    streamUsed += sizeof(record);
+  }
+  else {
+    if(streamUsed + STREAM_LINE_MAX > STREAM_BUFFER_SIZE){
+      flushStream();
+    }
+    streamUsed += formatSample(streamBuffer + streamUsed, s);
+  }
+}
+
+/*
+ * Writes out everything buffered so far.  Returns false once a write has
+ * failed, for instance because the reader of a pipe went away.
+ */
+bool flushStream(){
+  if(0 > streamFd or streamFailed){
+    return not streamFailed;
+  }
+  if(0 < streamUsed and not writeAll(streamFd, streamBuffer, streamUsed)){
+    streamFailed = true;
+  }
+  streamUsed = 0;
+  return not streamFailed;
+}
+
+void closeStream(){
+  if(0 > streamFd){
+    return;
+  }
+  flushStream();
+  if(streamOwnsFd){
+    close(streamFd);
+  }
+  streamFd = -1;
+  delete[] streamBuffer;
+  streamBuffer = NULL;
+}
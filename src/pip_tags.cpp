@@ -0,0 +1,406 @@
+/*
+ * Copyright (C) 2014 Robert S. Moore II and Rutgers University
+ * All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA
+ * or visit http://www.gnu.org/licenses/gpl-2.0.html
+ */
+
+/*******************************************************************************
+ * @file pip_tags.cpp
+ * Table of the latest sample from every tag heard, with O(1) lookup by tag
+ * ID and O(log n) conversion between tags and rows.
+ *
+ * @author Robert S. Moore II
+ ******************************************************************************/
+
+#include <math.h>
+#include <sys/time.h>
+
+#include <pip_tags.hpp>
+
+using std::vector;
+
+/*
+ * True if slot a is listed before slot b.
+ */
+static bool before(const tag_order_t& order, const vector<pip_sample_t>& samples, int a, int b){
+  if(order.keyed){
+    double ka = order.nodes[a].key;
+    double kb = order.nodes[b].key;
+    if(ka != kb){
+      return ka < kb;
+    }
+  }
+  return samples[a].tagID < samples[b].tagID;
+}
+
+static void resize(tag_order_t& order, int n){
+  tag_node_t& node = order.nodes[n];
+  node.size = 1 + order.nodes[node.left].size + order.nodes[node.right].size;
+}
+
+/*
+ * Splits the subtree at n into the slots listed before slot and the rest.
+ */
+static void split(tag_order_t& order, const vector<pip_sample_t>& samples, int n, int slot,
+    int& left, int& right){
+  if(0 == n){
+    left = right = 0;
+  }
+  else if(before(order, samples, n, slot)){
+    split(order, samples, order.nodes[n].right, slot, order.nodes[n].right, right);
+    left = n;
+    resize(order, n);
+  }
+  else {
+    split(order, samples, order.nodes[n].left, slot, left, order.nodes[n].left);
+    right = n;
+    resize(order, n);
+  }
+}
+
+/*
+ * Joins two subtrees, every slot of left listed before every slot of right.
+ */
+static int merge(tag_order_t& order, int left, int right){
+  if(0 == left or 0 == right){
+    return left + right;
+  }
+  if(order.nodes[left].priority > order.nodes[right].priority){
+    order.nodes[left].right = merge(order, order.nodes[left].right, right);
+    resize(order, left);
+    return left;
+  }
+  order.nodes[right].left = merge(order, left, order.nodes[right].left);
+  resize(order, right);
+  return right;
+}
+
+static int insertNode(tag_order_t& order, const vector<pip_sample_t>& samples, int n, int slot){
+  if(0 == n){
+    return slot;
+  }
+  if(order.nodes[slot].priority > order.nodes[n].priority){
+    split(order, samples, n, slot, order.nodes[slot].left, order.nodes[slot].right);
+    resize(order, slot);
+    return slot;
+  }
+  if(before(order, samples, slot, n)){
+    order.nodes[n].left = insertNode(order, samples, order.nodes[n].left, slot);
+  }
+  else {
+    order.nodes[n].right = insertNode(order, samples, order.nodes[n].right, slot);
+  }
+  resize(order, n);
+  return n;
+}
+
+static int eraseNode(tag_order_t& order, const vector<pip_sample_t>& samples, int n, int slot){
+  if(0 == n){
+    return 0;
+  }
+  if(n == slot){
+    return merge(order, order.nodes[n].left, order.nodes[n].right);
+  }
+  if(before(order, samples, slot, n)){
+    order.nodes[n].left = eraseNode(order, samples, order.nodes[n].left, slot);
+  }
+  else {
+    order.nodes[n].right = eraseNode(order, samples, order.nodes[n].right, slot);
+  }
+  resize(order, n);
+  return n;
+}
+
+/*
+ * Lists slot in order.  A keyed order lists it by the key already in its
+ * node, see orderInsertKey.
+ */
+void orderInsert(tag_order_t& order, const vector<pip_sample_t>& samples, int slot){
+  if(order.nodes.size() < samples.size()){
+    order.nodes.resize(samples.size());
+  }
+  //xorshift, the priorities only need to be independent of the keys
+  if(0 == order.seed){
+    order.seed = 2463534242u;
+  }
+  order.seed ^= order.seed << 13;
+  order.seed ^= order.seed >> 17;
+  order.seed ^= order.seed << 5;
+  tag_node_t& node = order.nodes[slot];
+  node.left = node.right = 0;
+  node.priority = order.seed;
+  node.size = 1;
+  order.root = insertNode(order, samples, order.root, slot);
+}
+
+/*
+ * Lists slot in a keyed order by key.
+ */
+void orderInsertKey(tag_order_t& order, const vector<pip_sample_t>& samples, int slot, double key){
+  if(order.nodes.size() < samples.size()){
+    order.nodes.resize(samples.size());
+  }
+  order.nodes[slot].key = key;
+  orderInsert(order, samples, slot);
+}
+
+/*
+ * Removes slot from the order.  Unless the order is keyed, its sample must
+ * still hold the values it was listed by.
+ */
+void orderErase(tag_order_t& order, const vector<pip_sample_t>& samples, int slot){
+  order.root = eraseNode(order, samples, order.root, slot);
+}
+
+/*
+ * Returns the row of slot, or -1 if it is not listed.
+ */
+int orderRank(const tag_order_t& order, const vector<pip_sample_t>& samples, int slot){
+  int rank = 0;
+  int n = order.root;
+  while(0 != n){
+    const tag_node_t& node = order.nodes[n];
+    if(n == slot){
+      return rank + order.nodes[node.left].size;
+    }
+    if(before(order, samples, slot, n)){
+      n = node.left;
+    }
+    else {
+      rank += order.nodes[node.left].size + 1;
+      n = node.right;
+    }
+  }
+  return -1;
+}
+
+/*
+ * Returns the slot listed at row, or 0 if there is no such row.
+ */
+int orderSelect(const tag_order_t& order, int row){
+  int n = order.root;
+  while(0 != n){
+    const tag_node_t& node = order.nodes[n];
+    int leftSize = order.nodes[node.left].size;
+    if(row < leftSize){
+      n = node.left;
+    }
+    else if(row == leftSize){
+      return n;
+    }
+    else {
+      row -= leftSize + 1;
+      n = node.right;
+    }
+  }
+  return 0;
+}
+
+/*
+ * Returns the slot of the tag, or 0 if it is not in the table.
+ */
+int findTag(const tag_table_t& table, int tagID){
+  std::unordered_map<int,int>::const_iterator it = table.slots.find(tagID);
+  return it == table.slots.end() ? 0 : it->second;
+}
+
+/*
+ * Sort keys of the orders after SORT_ID, each putting first the tags most
+ * likely to need attention.  Tags without the value go last.
+ */
+typedef double (*tag_key_t)(const pip_sample_t&);
+
+static double signalKey(const pip_sample_t& s){
+  return s.rssi;
+}
+
+static double silenceKey(const pip_sample_t& s){
+  return s.time.tv_sec * 1000000.0 + s.time.tv_usec;
+}
+
+static double batteryKey(const pip_sample_t& s){
+  return s.batteryMv > 0 ? s.batteryMv : HUGE_VAL;
+}
+
+static double heatKey(const pip_sample_t& s){
+  return s.tempC > -300 ? -s.tempC : HUGE_VAL;
+}
+
+static double periodKey(const pip_sample_t& s){
+  return s.interval;
+}
+
+static double confidenceKey(const pip_sample_t& s){
+  return s.intervalConfidence;
+}
+
+static const tag_key_t sortKeys[SORT_ORDERS] = {
+  NULL,           // SORT_ID
+  signalKey,      // SORT_RSSI
+  silenceKey,     // SORT_LAST_SEEN
+  batteryKey,     // SORT_BATTERY
+  heatKey,        // SORT_TEMPERATURE
+  periodKey,      // SORT_PERIOD
+  confidenceKey   // SORT_CONFIDENCE
+};
+
+/*
+ * Lists slot in order o of the table by its current sample.
+ */
+static void listTag(tag_table_t& table, int o, int slot){
+  if(SORT_ID == o){
+    orderInsert(table.orders[o], table.samples, slot);
+  }
+  else {
+    orderInsertKey(table.orders[o], table.samples, slot, sortKeys[o](table.samples[slot]));
+  }
+}
+
+/*
+ * Lists every tag in order o, which must be empty.
+ */
+static void buildOrder(tag_table_t& table, int o){
+  table.orders[o].keyed = SORT_ID != o;
+  for(std::unordered_map<int,int>::const_iterator it = table.slots.begin(); it != table.slots.end(); ++it){
+    listTag(table, o, it->second);
+  }
+}
+
+/*
+ * Returns the slot of the tag, adding it with a zeroed sample if it is new.
+ */
+int insertTag(tag_table_t& table, int tagID){
+  int slot = findTag(table, tagID);
+  if(0 != slot){
+    return slot;
+  }
+  if(table.samples.empty()){
+    table.samples.resize(1);
+  }
+  if(table.freeSlots.empty()){
+    slot = table.samples.size();
+    table.samples.push_back(pip_sample_t());
+  }
+  else {
+    slot = table.freeSlots.back();
+    table.freeSlots.pop_back();
+    table.samples[slot] = pip_sample_t();
+  }
+  table.samples[slot].tagID = tagID;
+  table.slots[tagID] = slot;
+  listTag(table, SORT_ID, slot);
+  if(SORT_ID != table.sort){
+    listTag(table, table.sort, slot);
+  }
+  return slot;
+}
+
+/*
+ * Removes the tag, returning false if it was not in the table.
+ */
+bool removeTag(tag_table_t& table, int tagID){
+  int slot = findTag(table, tagID);
+  if(0 == slot){
+    return false;
+  }
+  orderErase(table.orders[SORT_ID], table.samples, slot);
+  if(SORT_ID != table.sort){
+    orderErase(table.orders[table.sort], table.samples, slot);
+  }
+  table.slots.erase(tagID);
+  table.freeSlots.push_back(slot);
+  return true;
+}
+
+/*
+ * Moves the tag in slot to where its changed sample lists it.  Its tag ID
+ * cannot change, so it keeps its place by ID, and in a sorted list it only
+ * moves if its sort key changed.  Returns the row it was listed at before
+ * if it moved, otherwise -1.
+ */
+int tagAfterUpdate(tag_table_t& table, int slot){
+  if(SORT_ID == table.sort){
+    return -1;
+  }
+  tag_order_t& order = table.orders[table.sort];
+  double key = sortKeys[table.sort](table.samples[slot]);
+  if(key == order.nodes[slot].key){
+    return -1;
+  }
+  int row = orderRank(order, table.samples, slot);
+  orderErase(order, table.samples, slot);
+  orderInsertKey(order, table.samples, slot, key);
+  return row;
+}
+
+/*
+ * Lists every tag again from the slots in use, as after the table was
+ * restored without its orders.
+ */
+void rebuildSortOrders(tag_table_t& table){
+  for(int o = 0; o < SORT_ORDERS; ++o){
+    table.orders[o] = tag_order_t();
+  }
+  buildOrder(table, SORT_ID);
+  if(SORT_ID != table.sort){
+    buildOrder(table, table.sort);
+  }
+}
+
+/*
+ * Lists the main list in another order.  The order it was listed in is
+ * dropped, and the new one built in O(n log n).
+ */
+void sortTags(tag_table_t& table, int sort){
+  if(sort == table.sort){
+    return;
+  }
+  if(SORT_ID != table.sort){
+    table.orders[table.sort] = tag_order_t();
+  }
+  table.sort = sort;
+  if(SORT_ID != sort){
+    buildOrder(table, sort);
+  }
+}
+
+/*
+ * Returns the row of the tag in the main list, or -1 if it is not listed.
+ */
+int tagRow(const tag_table_t& table, int tagID){
+  int slot = findTag(table, tagID);
+  return 0 == slot ? -1 : orderRank(table.orders[table.sort], table.samples, slot);
+}
+
+/*
+ * Returns the ID of the tag at row of the main list, or -1 for no such row.
+ */
+int tagAtRow(const tag_table_t& table, int row){
+  int slot = slotAtRow(table, row);
+  return 0 == slot ? -1 : table.samples[slot].tagID;
+}
+
+/*
+ * Returns the slot of the tag at row of the main list, or 0 for no such row.
+ */
+int slotAtRow(const tag_table_t& table, int row){
+  return row < 0 ? 0 : orderSelect(table.orders[table.sort], row);
+}
+
+int tagCount(const tag_table_t& table){
+  return table.slots.size();
+}
@@ -0,0 +1,785 @@
+/*
+ * Copyright (c) 2012 Bernhard Firner and Rutgers University
+ * Copyright (C) 2014 Robert S. Moore II and Rutgers University
+ * All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA
+ * or visit http://www.gnu.org/licenses/gpl-2.0.html
+ */
+
+/*******************************************************************************
+ * @file pip_usb.cpp
+ * Asynchronous acquisition of packets from PIP receivers.  Every receiver
+ * keeps several LM_GET_NEXT_PACKET requests and reads queued with
+ * libusb_submit_transfer, and completions are handled by callbacks from
+ * within libusb's event handling.
+ *
+ * Each receiver is opened in its own libusb context and served by its own
+ * acquisition thread, so a slow receiver (or a slow UI) never delays the
+ * others.  Decoded samples are pushed into the receiver's SpscRing, which the
+ * UI thread drains.
+ *
+ * @author Bernhard Firner
+ * @author Robert S. Moore II
+ ******************************************************************************/
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/time.h>
+#include <sys/eventfd.h>
+
+#include <arpa/inet.h>
+
+#include <algorithm>
+#include <list>
+#include <map>
+
+#include <pip_sensor.hpp>
+#include <pip_usb.hpp>
+#include <pip_util.hpp>
+
+using std::list;
+using std::map;
+
+//USB PIPs' vendor ID and strings
+const char *silicon_labs_s = "Silicon Labs\0";
+const char *serial_num_s = "1234\0";
+
+//Map of usb devices in use, accessed by the USB device number
+map<int, bool> in_use;
+
+//Set while raw frames should be handed out for capturing
+std::atomic<bool> capturingFrames(false);
+
+static_assert(PACKET_LEN + PACKET_EXTRA_LEN + 1 <= CAPTURE_FRAME_SIZE, "Capture records are too small for a frame");
+
+//Signalled by the acquisition threads when they have samples for the UI thread
+static int wakeFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+
+//The 8051 PIP
+#define SILICON_LABS_VENDOR  ((unsigned short) (0x10C4))
+#define SILICON_LABS_PIPPROD ((unsigned char) (0x03))
+
+//The MSP430 PIP
+#define TI_LABS_VENDOR  ((unsigned short) (0x2047))
+#define TI_LABS_PIPPROD ((unsigned short) (0x0300))
+
+/*
+ * Wakes up the UI thread if it is waiting in poll on pipWakeFd.
+ */
+void wakePIPs(){
+  uint64_t one = 1;
+  if(sizeof(one) != write(wakeFd, &one, sizeof(one))){
+    //Counter is already non-zero, the UI thread will wake up anyway
+  }
+}
+
+/*
+ * File descriptor that becomes readable when an acquisition thread has pushed
+ * samples or stopped.  Call clearPIPWake once it polls readable.
+ */
+int pipWakeFd(){
+  return wakeFd;
+}
+
+void clearPIPWake(){
+  uint64_t count;
+  if(sizeof(count) != read(wakeFd, &count, sizeof(count))){
+    //Nothing was pending
+  }
+}
+
+float toFloat(unsigned char* pipFloat) {
+    return ((float)pipFloat[0] * 0x100 + (float)pipFloat[1] + (float)pipFloat[2] / (float)0x100);
+}
+
+/*
+ * Decodes a frame read from a receiver at the given host time into s.
+ * Returns false if the frame is not a good packet or its extra data is
+ * shorter than its sensor header says.
+ */
+bool decodeFrame(const unsigned char* buf, int transferred, const timeval& received, pip_sample_t& s){
+  if(PACKET_LEN > transferred){
+    return false;
+  }
+  //Overlay the packet struct on top of the pointer to the pip's message.
+  const pip_packet_t *pkt = (const pip_packet_t *)buf;
+
+  //Check to make sure this was a good packet.
+  if ((pkt->rssi == (int) 0) or (pkt->lqi == 0) or (not pkt->crcok)) {
+    return false;
+  }
+  const unsigned char* data = (const unsigned char*)pkt;
+
+  unsigned int netID = ((unsigned int)data[9] * 65536)  + ((unsigned int)data[10] * 256) +
+    ((unsigned int)data[11] );
+  //We do not currently use the pip's local timestamp
+  //unsigned long time = ntohl(pkt->time);
+//  unsigned long baseID = ntohl(pkt->boardID << 8);
+  s.tagID = netID;
+
+  //Set this to the real timestamp, milliseconds since 1970
+  s.time = received;
+  s.rcvTime = ntohl(pkt->time);
+  s.dropped = pkt->dropped;
+  //Convert from one byte value to a float for receive signal
+  //strength as described in the TI/chipcon Design Note DN505 on cc1100
+  s.rssi = ( (pkt->rssi) >= 128 ? (signed int)(pkt->rssi-256)/2.0 : (pkt->rssi)/2.0) - RSSI_OFFSET;
+  //The extra data must have been read completely and hold what its header announces
+  if(PACKET_EXTRA_LEN < pkt->ex_length or transferred - PACKET_LEN < pkt->ex_length){
+    return false;
+  }
+  initPipData(s);
+  return decodeSensorData(pkt->data, pkt->ex_length, s);
+}
+
+/*
+ * Records a failed transfer or submission.  A missing device or the
+ * "unknown" libusb error fail the receiver at once, anything else only after
+ * PIP_MAX_FAILURES failures in a row.
+ */
+static void noteFailure(pip_receiver_t* rcv, int err){
+  if(rcv->closing){
+    return;
+  }
+  ++rcv->health.errors[std::min(-err, PIP_ERROR_CODES - 1)];
+  ++rcv->failures;
+  if(LIBUSB_ERROR_OTHER == err or LIBUSB_ERROR_NO_DEVICE == err or
+      rcv->failures >= PIP_MAX_FAILURES){
+    if(0 == rcv->error){
+      rcv->error = err;
+    }
+  }else {
+    ++rcv->health.retries;
+  }
+}
+
+/*
+ * Adds a request to read round trip to the receiver's latency histogram.
+ */
+static void noteLatency(pip_receiver_t* rcv, double ms){
+  long us = (long)(ms * 1000.0);
+  int bucket = 0;
+  while(bucket < PIP_LATENCY_BUCKETS - 1 and us >= ((long)PIP_LATENCY_BASE << bucket)){
+    ++bucket;
+  }
+  ++rcv->health.latency[bucket];
+}
+
+static int statusToError(int status){
+  switch(status){
+    case LIBUSB_TRANSFER_TIMED_OUT:
+      return LIBUSB_ERROR_TIMEOUT;
+    case LIBUSB_TRANSFER_NO_DEVICE:
+      return LIBUSB_ERROR_NO_DEVICE;
+    case LIBUSB_TRANSFER_STALL:
+      return LIBUSB_ERROR_PIPE;
+    case LIBUSB_TRANSFER_OVERFLOW:
+      return LIBUSB_ERROR_OVERFLOW;
+    default:
+      return LIBUSB_ERROR_IO;
+  }
+}
+
+/*
+ * Queues a request for the next packet and the read for its answer.
+ */
+static void armSlot(pip_slot_t* slot){
+  pip_receiver_t* rcv = slot->receiver;
+  if(rcv->closing or rcv->error){
+    return;
+  }
+  slot->idleUntil = 0;
+  slot->gotFrame = false;
+
+  slot->cmd = LM_GET_NEXT_PACKET;
+  slot->requested = nowMs();
+  int retval = libusb_submit_transfer(slot->request);
+  if(0 > retval){
+    noteFailure(rcv, retval);
+    slot->idleUntil = slot->requested + rcv->idleDelay;
+    return;
+  }
+  slot->requestBusy = true;
+  ++rcv->inFlight;
+  ++rcv->health.requests;
+
+  retval = libusb_submit_transfer(slot->read);
+  if(0 > retval){
+    noteFailure(rcv, retval);
+    return;
+  }
+  slot->readBusy = true;
+  ++rcv->inFlight;
+}
+
+/*
+ * Called when both transfers of a slot are finished.  Slots that returned a
+ * packet are re-armed immediately since the receiver may have more queued.
+ * Otherwise the slot waits before asking again, and the wait doubles (up to
+ * PIP_IDLE_DELAY_MAX) for as long as the receiver has nothing to send, so a
+ * quiet receiver costs next to no CPU.
+ */
+static void slotDone(pip_slot_t* slot){
+  if(slot->requestBusy or slot->readBusy){
+    return;
+  }
+  pip_receiver_t* rcv = slot->receiver;
+  if(slot->gotFrame){
+    rcv->idleDelay = PIP_IDLE_DELAY;
+    armSlot(slot);
+  }else {
+    slot->idleUntil = nowMs() + rcv->idleDelay;
+    rcv->idleDelay = std::min(rcv->idleDelay * 2, PIP_IDLE_DELAY_MAX);
+  }
+}
+
+/*
+ * Handles a frame read into buf+1 by the receiver's acquisition thread:
+ * captures it if a capture is running, then decodes it and hands the sample
+ * to the UI thread.  Every frame handled in one batch (see batchTimed) gets
+ * the same host time.
+ */
+void handleFrame(pip_receiver_t* rcv, unsigned char* buf, int transferred){
+  if(not rcv->batchTimed){
+    gettimeofday(&rcv->batchTime, NULL);
+    rcv->batchTimed = true;
+  }
+  //Fill in the length of the extra portion of the packet
+  buf[0] = transferred - PACKET_LEN;
+  if(capturingFrames){
+    capture_record_t record;
+    record.hostTime = (uint64_t)rcv->batchTime.tv_sec * 1000000 + rcv->batchTime.tv_usec;
+    record.receiver = rcv->deviceNum;
+    record.length = transferred;
+    record.reserved = 0;
+    memcpy(record.frame, buf, transferred + 1);
+    memset(record.frame + transferred + 1, 0, CAPTURE_FRAME_SIZE - transferred - 1);
+    rcv->bytesCopied += transferred + 1;
+    rcv->captures.push(record);
+    rcv->pushed = true;
+  }
+  pip_sample_t s;
+  ++rcv->frames;
+  rcv->health.bytes += transferred;
+  //Dropped packet count is the first byte from the PIP
+  rcv->health.dropped += buf[1];
+  if(decodeFrame(buf, transferred, rcv->batchTime, s)){
+    //Overflows are counted by the ring
+    rcv->samples.push(s);
+    rcv->pushed = true;
+  }
+}
+
+static void LIBUSB_CALL requestDone(libusb_transfer* transfer){
+  pip_slot_t* slot = (pip_slot_t*)transfer->user_data;
+  pip_receiver_t* rcv = slot->receiver;
+  slot->requestBusy = false;
+  --rcv->inFlight;
+  if(LIBUSB_TRANSFER_COMPLETED != transfer->status and
+      LIBUSB_TRANSFER_CANCELLED != transfer->status){
+    noteFailure(rcv, statusToError(transfer->status));
+  }
+  slotDone(slot);
+}
+
+static void LIBUSB_CALL readDone(libusb_transfer* transfer){
+  pip_slot_t* slot = (pip_slot_t*)transfer->user_data;
+  pip_receiver_t* rcv = slot->receiver;
+  slot->readBusy = false;
+  --rcv->inFlight;
+  if(LIBUSB_TRANSFER_COMPLETED == transfer->status){
+    rcv->failures = 0;
+    noteLatency(rcv, nowMs() - slot->requested);
+    int transferred = transfer->actual_length;
+    //If the length of the message is equal to or greater than PACKET_LEN then this is a data packet.
+    //Sensor data cut short after that is caught by decodeFrame.
+    if(PACKET_LEN <= transferred and not rcv->closing){
+      slot->gotFrame = true;
+      //The connection works again, so the next failure starts a fresh backoff
+      rcv->reconnectAttempts = 0;
+      rcv->backoff = PIP_BACKOFF_MIN;
+      handleFrame(rcv, slot->buf, transferred);
+    }else if(0 < transferred and not rcv->closing){
+      //A short completion holds too little of the frame to decode it
+      ++rcv->health.partialReads;
+    }else {
+      ++rcv->health.emptyReads;
+    }
+  }
+  else if(LIBUSB_TRANSFER_TIMED_OUT == transfer->status){
+    //An idle receiver has nothing to answer with, so this is not a failure.
+    //slotDone asks again after the idle backoff.
+    ++rcv->health.timeouts;
+  }
+  else if(LIBUSB_TRANSFER_CANCELLED != transfer->status){
+    noteFailure(rcv, statusToError(transfer->status));
+  }
+  slotDone(slot);
+}
+
+/*
+ * Opens, resets, and claims a PIP.  Returns NULL if the device could not be
+ * opened.
+ */
+static libusb_device_handle* openDevice(libusb_device* dev){
+  libusb_device_handle* new_handle;
+  int err = libusb_open(dev, &new_handle);
+
+  if (0 != err) {
+    if (LIBUSB_ERROR_ACCESS == err) {
+//      std::cout<<"Insufficient permission to open reader (try sudo).\n";
+    }
+    return NULL;
+  }
+  //Reset the device before trying to use it
+  if (0 != libusb_reset_device(new_handle)) {
+    libusb_close(new_handle);
+    return NULL;
+  }
+
+  int retval = libusb_set_configuration(new_handle, 1);
+  if (0 != retval ) {
+    switch(retval){
+      case LIBUSB_ERROR_NOT_FOUND:
+        //printf("Device not found.\n");
+        break;
+        case LIBUSB_ERROR_BUSY:
+        //printf("Device is busy.\n");
+        retval = libusb_detach_kernel_driver(new_handle,0);
+        if(0 != retval){
+          //printf("Unable to detach kernel driver with error number %d.\n",retval);
+        }
+        retval = libusb_set_configuration(new_handle,1);
+        break;
+        case LIBUSB_ERROR_NO_DEVICE:
+        //printf("No device present.\n");
+        break;
+        default:
+        //printf("Unknown error.\n");
+        break;
+    }
+    //printf("Setting configuration to 1 failed with error number %d \n",retval);
+  }
+  else {
+    int interface_num = 0;
+
+    //Detach the kernel driver on linux
+    if (libusb_kernel_driver_active(new_handle, interface_num)) {
+      libusb_detach_kernel_driver(new_handle, interface_num);
+    }
+    //Retry claiming the device up to two times.
+    int retries = 2;
+
+    while ((retval = libusb_claim_interface(new_handle, interface_num)) && retries-- > 0) {
+      ;
+    }
+    //int alt_setting = 0;
+    //libusb_set_interface_alt_setting(new_handle, interface_num, alt_setting);
+    if (0 == retries) {
+//      std::cerr<<"usb_claim_interface failed\n";
+//      std::cerr<<"If the interface cannot be claimed try running with root privileges.\n";
+    }
+  }
+  return new_handle;
+}
+
+/*
+ * Keeps the receiver's transfers queued and handles their completions until
+ * the receiver fails or the UI thread closes it.  Leaves no transfers in
+ * flight.
+ */
+static void acquire(pip_receiver_t* rcv){
+  rcv->idleDelay = PIP_IDLE_DELAY;
+  for(int i = 0; i < PIP_TRANSFER_DEPTH; ++i){
+    armSlot(&rcv->slots[i]);
+  }
+  while(not rcv->closing and 0 == rcv->error){
+    //Sleep until a transfer completes or the next idle slot is due. Never
+    //sleep longer than a transfer timeout so closing is noticed.
+    double now = nowMs();
+    double wake = now + PIP_TRANSFER_TIMEOUT;
+    for(int i = 0; i < PIP_TRANSFER_DEPTH; ++i){
+      if(rcv->slots[i].idleUntil > 0 and rcv->slots[i].idleUntil < wake){
+        wake = rcv->slots[i].idleUntil;
+      }
+    }
+    long waitUs = (wake > now) ? (long)((wake - now) * 1000) : 0;
+    timeval tv = {waitUs / 1000000, waitUs % 1000000};
+    libusb_handle_events_timeout_completed(rcv->ctx, &tv, NULL);
+    //Frames completed by the next call are a new batch
+    rcv->batchTimed = false;
+
+    if(rcv->pushed){
+      rcv->pushed = false;
+      wakePIPs();
+    }
+
+    now = nowMs();
+    for(int i = 0; i < PIP_TRANSFER_DEPTH; ++i){
+      pip_slot_t* slot = &rcv->slots[i];
+      if(slot->idleUntil > 0 and slot->idleUntil <= now and
+          not slot->requestBusy and not slot->readBusy){
+        armSlot(slot);
+      }
+    }
+  }
+
+  for(int i = 0; i < PIP_TRANSFER_DEPTH; ++i){
+    if(rcv->slots[i].requestBusy){
+      libusb_cancel_transfer(rcv->slots[i].request);
+    }
+    if(rcv->slots[i].readBusy){
+      libusb_cancel_transfer(rcv->slots[i].read);
+    }
+  }
+  //Transfers can only be freed or reused after their callbacks ran.  Every
+  //cancelled transfer completes, at the latest when it times out.
+  while(rcv->inFlight > 0){
+    timeval tv = {0, 10000};
+    libusb_handle_events_timeout(rcv->ctx, &tv);
+  }
+}
+
+/*
+ * Points the receiver's transfers at its current device handle.
+ */
+static void fillTransfers(pip_receiver_t* rcv){
+  //Old PIPs answer on endpoint 1, GPIPs on endpoint 2
+  unsigned char readEndpoint = (OLD_PIP == rcv->version ? 1 : 2) | LIBUSB_ENDPOINT_IN;
+  for(int i = 0; i < PIP_TRANSFER_DEPTH; ++i){
+    pip_slot_t* slot = &rcv->slots[i];
+    slot->requestBusy = false;
+    slot->readBusy = false;
+    slot->idleUntil = 0;
+    libusb_fill_bulk_transfer(slot->request, rcv->handle, 2 | LIBUSB_ENDPOINT_OUT,
+        &slot->cmd, 1, requestDone, slot, PIP_TRANSFER_TIMEOUT);
+    //Allow up to 20 extra bytes of sensor data beyond the normal packet length.
+    libusb_fill_bulk_transfer(slot->read, rcv->handle, readEndpoint,
+        slot->buf+1, PACKET_LEN+PACKET_EXTRA_LEN, readDone, slot, PIP_TRANSFER_TIMEOUT);
+  }
+}
+
+/*
+ * Finds the receiver's device by bus and address in its own context, which
+ * is created first if needed, and opens it.  Returns 0 or the libusb error
+ * that kept the device from being opened.
+ */
+static int reopenDevice(pip_receiver_t* rcv){
+  if(NULL == rcv->ctx and 0 != libusb_init(&rcv->ctx)){
+    rcv->ctx = NULL;
+    return LIBUSB_ERROR_OTHER;
+  }
+  int err = LIBUSB_ERROR_NOT_FOUND;
+  libusb_device **devices = NULL;
+  ssize_t count = libusb_get_device_list(rcv->ctx, &devices);
+  for (int dev_idx = 0; dev_idx < count; ++dev_idx) {
+    libusb_device* dev = devices[dev_idx];
+    if(rcv->bus == libusb_get_bus_number(dev) and rcv->address == libusb_get_device_address(dev)){
+      rcv->handle = openDevice(dev);
+      err = (NULL == rcv->handle) ? LIBUSB_ERROR_IO : 0;
+      break;
+    }
+  }
+  libusb_free_device_list(devices, true);
+  return err;
+}
+
+/*
+ * Releases and closes the receiver's device, if it is open.
+ */
+static void closeDevice(pip_receiver_t* rcv){
+  if(NULL != rcv->handle){
+    libusb_release_interface(rcv->handle, 0);
+    libusb_close(rcv->handle);
+    rcv->handle = NULL;
+  }
+}
+
+/*
+ * Sleeps up to ms milliseconds, returning early if the receiver is closed.
+ */
+static void backoffSleep(pip_receiver_t* rcv, double ms){
+  double until = nowMs() + ms;
+  for(double now = nowMs(); now < until and not rcv->closing; now = nowMs()){
+    usleep((useconds_t)std::min(100000.0, (until - now) * 1000.0));
+  }
+}
+
+/*
+ * Body of a receiver's thread, which runs the receiver's lifecycle:
+ *   opening -> active -> backoff -> reset -> opening ...
+ * A receiver that fails is closed and waits out its backoff, which doubles
+ * up to PIP_BACKOFF_MAX with every failed attempt.  It then gets a fresh
+ * libusb context, so even LIBUSB_ERROR_OTHER only costs this receiver its
+ * connection, and is opened again.  A receiver that was unplugged, or that
+ * could not be brought back after PIP_MAX_RECONNECTS attempts, fails and
+ * its thread ends, leaving it for the UI thread to close.  Other receivers
+ * are never blocked.
+ */
+static void run(pip_receiver_t* rcv){
+  rcv->backoff = PIP_BACKOFF_MIN;
+  while(not rcv->closing and PIP_STATE_FAILED != rcv->state){
+    switch(rcv->state){
+      case PIP_STATE_OPENING:
+        {
+          //Reset, configuration and claiming take a while, which is why
+          //every receiver is brought up on its own thread
+          double start = nowMs();
+          int err = reopenDevice(rcv);
+          if(0 == err){
+            fillTransfers(rcv);
+            rcv->failures = 0;
+            rcv->error = 0;
+            double now = nowMs();
+            rcv->health.openUs = (unsigned long)((now - start) * 1000.0);
+            if(0 == rcv->health.startupUs){
+              rcv->health.startupUs = std::max(1UL, (unsigned long)((now - rcv->created) * 1000.0));
+            }
+            rcv->state = PIP_STATE_ACTIVE;
+            //Let the UI thread report that the receiver is up
+            wakePIPs();
+          }else if(0 == rcv->health.startupUs){
+            //Never opened, so there is nothing to reconnect to
+            rcv->error = err;
+            rcv->state = PIP_STATE_FAILED;
+          }else {
+            rcv->state = PIP_STATE_BACKOFF;
+          }
+        }
+        break;
+      case PIP_STATE_ACTIVE:
+        acquire(rcv);
+        if(rcv->closing){
+          break;
+        }
+        closeDevice(rcv);
+        //Unplugged devices come back at a new address, if at all
+        rcv->state = (LIBUSB_ERROR_NO_DEVICE == rcv->error) ? PIP_STATE_FAILED : PIP_STATE_BACKOFF;
+        break;
+      case PIP_STATE_BACKOFF:
+        if(rcv->reconnectAttempts >= PIP_MAX_RECONNECTS){
+          rcv->state = PIP_STATE_FAILED;
+          break;
+        }
+        backoffSleep(rcv, rcv->backoff);
+        rcv->backoff = std::min(rcv->backoff * 2, PIP_BACKOFF_MAX);
+        ++rcv->reconnectAttempts;
+        rcv->state = PIP_STATE_RESET;
+        break;
+      case PIP_STATE_RESET:
+        //Opening creates a fresh context.  acquire left no transfers that
+        //the old one still owns.
+        libusb_exit(rcv->ctx);
+        rcv->ctx = NULL;
+        ++rcv->health.reconnects;
+        rcv->state = PIP_STATE_OPENING;
+        break;
+    }
+  }
+  //Let the UI thread notice that this receiver failed or stopped
+  rcv->stopped = true;
+  wakePIPs();
+}
+
+/*
+ * Starts the thread of the PIP at the given bus and address.  The thread
+ * opens the device in a libusb context of its own, so this returns at once
+ * and several receivers come up in parallel.  A receiver that cannot be
+ * opened fails (see PIP_STATE_FAILED) instead.
+ */
+static pip_receiver_t* openPIP(int bus, int address, int8_t version, int device_num){
+  pip_receiver_t* rcv = new pip_receiver_t();
+  rcv->bus = bus;
+  rcv->address = address;
+  rcv->deviceNum = device_num;
+  rcv->version = version;
+  rcv->created = nowMs();
+  for(int i = 0; i < PIP_TRANSFER_DEPTH; ++i){
+    pip_slot_t* slot = &rcv->slots[i];
+    slot->receiver = rcv;
+    slot->buf = rcv->framePool[i];
+    slot->request = libusb_alloc_transfer(0);
+    slot->read = libusb_alloc_transfer(0);
+  }
+  rcv->state = PIP_STATE_OPENING;
+  rcv->thread = std::thread(run, rcv);
+  return rcv;
+}
+
+/*
+ * Stops the receiver's thread, releases and closes the device.  The receiver
+ * is deleted.  This waits for the thread unless it has stopped already.
+ */
+void closePIP(pip_receiver_t* rcv){
+  rcv->closing = true;
+  if(rcv->thread.joinable()){
+    rcv->thread.join();
+  }
+  closeDevice(rcv);
+  //Simulated receivers have no transfers or context
+  for(int i = 0; i < PIP_TRANSFER_DEPTH; ++i){
+    libusb_free_transfer(rcv->slots[i].request);
+    libusb_free_transfer(rcv->slots[i].read);
+  }
+  if(NULL != rcv->ctx){
+    libusb_exit(rcv->ctx);
+  }
+  in_use[rcv->deviceNum] = false;
+  delete rcv;
+}
+
+/*
+ * Returns the PIP version of a device, or NOT_PIP.
+ */
+static int8_t pipVersion(libusb_device* dev){
+  libusb_device_descriptor desc;
+  if (0 >= libusb_get_device_descriptor(dev, &desc)) {
+    if (((unsigned short) desc.idVendor ==  (unsigned short) TI_LABS_VENDOR) and
+        ((unsigned short) desc.idProduct == (unsigned short) TI_LABS_PIPPROD)) {
+      return GPIP;
+    }
+    else if (((unsigned short) desc.idVendor ==  (unsigned short) SILICON_LABS_VENDOR) and
+        ((unsigned short) desc.idProduct == (unsigned short) SILICON_LABS_PIPPROD)) {
+      return OLD_PIP;
+    }
+  }
+  return NOT_PIP;
+}
+
+/*
+ * Opens a PIP if it is not already open and adds it to pip_devs.
+ */
+static void attachPIP(list<pip_receiver_t*> &pip_devs, int bus, int address, int8_t version){
+  //Make the device number a combination of bus number and the address on the bus
+  int device_num = 0x100 * bus + address;
+
+  //See if we found a pip that is not already open
+  if (NOT_PIP != version && not in_use[device_num]) {
+    //Add the new device to the pip device list, it is opened in the background
+    pip_devs.push_back(openPIP(bus, address, version, device_num));
+    in_use[device_num] = true;
+  }
+}
+
+/*
+ * Legacy code (from GRAIL?) that needs to be replaced.
+ *
+ * Idea: Scan the USB tree, extract PIPs, grab a packet (to read ID), and
+ *       present them to the user to pick one.
+ *
+ * Only used periodically when libusb has no hotplug support, otherwise
+ * receivers are attached from hotplug events (see watchPIPs).
+ */
+void attachPIPs(list<pip_receiver_t*> &pip_devs) {
+  //An array of pointers to usb devices.
+  libusb_device **devices = NULL;
+
+  //Get the device list
+  ssize_t count = libusb_get_device_list(NULL, &devices);
+
+  //Scan for new pips
+  for (int dev_idx = 0; dev_idx < count; ++dev_idx) {
+    libusb_device* dev = devices[dev_idx];
+    attachPIP(pip_devs, libusb_get_bus_number(dev), libusb_get_device_address(dev), pipVersion(dev));
+  }
+
+  //Free the device list
+  libusb_free_device_list(devices, true);
+}
+
+/*
+ * A PIP arriving on or leaving the bus.  Hotplug callbacks only queue these,
+ * the receivers are opened and closed by updatePIPs outside of libusb's
+ * event handling.
+ */
+typedef struct {
+  bool arrived;
+  int bus;
+  int address;
+  int8_t version;
+} pip_hotplug_t;
+
+static list<pip_hotplug_t> hotplugEvents;
+
+#ifdef LIBUSB_HOTPLUG_MATCH_ANY
+static int LIBUSB_CALL hotplugEvent(libusb_context*, libusb_device* dev, libusb_hotplug_event event, void*){
+  pip_hotplug_t hp;
+  hp.arrived = (LIBUSB_HOTPLUG_EVENT_DEVICE_ARRIVED == event);
+  hp.bus = libusb_get_bus_number(dev);
+  hp.address = libusb_get_device_address(dev);
+  hp.version = hp.arrived ? pipVersion(dev) : NOT_PIP;
+  hotplugEvents.push_back(hp);
+  //Keep the callback registered
+  return 0;
+}
+#endif
+
+/*
+ * Registers hotplug callbacks for both kinds of PIP on the default context.
+ * PIPs already on the bus are reported as arrivals right away.  Returns false
+ * if this libusb cannot do hotplug, in which case the caller should fall back
+ * to scanning with attachPIPs.
+ */
+bool watchPIPs(){
+#ifdef LIBUSB_HOTPLUG_MATCH_ANY
+  if (not libusb_has_capability(LIBUSB_CAP_HAS_HOTPLUG)) {
+    return false;
+  }
+  libusb_hotplug_event events = (libusb_hotplug_event)(LIBUSB_HOTPLUG_EVENT_DEVICE_ARRIVED | LIBUSB_HOTPLUG_EVENT_DEVICE_LEFT);
+  libusb_hotplug_callback_handle gpipHandle, oldPipHandle;
+  if (0 != libusb_hotplug_register_callback(NULL, events, LIBUSB_HOTPLUG_ENUMERATE,
+        TI_LABS_VENDOR, TI_LABS_PIPPROD, LIBUSB_HOTPLUG_MATCH_ANY,
+        hotplugEvent, NULL, &gpipHandle)) {
+    return false;
+  }
+  if (0 != libusb_hotplug_register_callback(NULL, events, LIBUSB_HOTPLUG_ENUMERATE,
+        SILICON_LABS_VENDOR, SILICON_LABS_PIPPROD, LIBUSB_HOTPLUG_MATCH_ANY,
+        hotplugEvent, NULL, &oldPipHandle)) {
+    libusb_hotplug_deregister_callback(NULL, gpipHandle);
+    hotplugEvents.clear();
+    return false;
+  }
+  return true;
+#else
+  return false;
+#endif
+}
+
+/*
+ * Opens the receivers that arrived and stops the ones that left since the
+ * last call.  Hotplug events are delivered while handling events on the
+ * default context.  A receiver that left is only told to stop, its thread
+ * may still be waiting for transfers to complete.  The thread wakes the UI
+ * thread once it has stopped, and the receiver is closed then.
+ */
+void updatePIPs(list<pip_receiver_t*> &pip_devs){
+  while (not hotplugEvents.empty()) {
+    pip_hotplug_t hp = hotplugEvents.front();
+    hotplugEvents.pop_front();
+    if (hp.arrived) {
+      attachPIP(pip_devs, hp.bus, hp.address, hp.version);
+      continue;
+    }
+    int device_num = 0x100 * hp.bus + hp.address;
+    for (list<pip_receiver_t*>::iterator I = pip_devs.begin(); I != pip_devs.end(); ++I) {
+      if (device_num == (*I)->deviceNum) {
+        (*I)->closing = true;
+        break;
+      }
+    }
+  }
+}
@@ -0,0 +1,50 @@
+/*
+ * Copyright (C) 2014 Robert S. Moore II and Rutgers University
+ * All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA
+ * or visit http://www.gnu.org/licenses/gpl-2.0.html
+ */
+
+/*******************************************************************************
+ * @file pip_util.cpp
+ * Small helpers shared by the receiver, replay, output and benchmark code.
+ *
+ * @author Robert S. Moore II
+ ******************************************************************************/
+
+#include <unistd.h>
+#include <sys/time.h>
+
+#include <pip_util.hpp>
+
+double nowMs(){
+  timeval tval;
+  gettimeofday(&tval, NULL);
+  return tval.tv_sec * 1000.0 + tval.tv_usec/1000.0;
+}
+
+bool writeAll(int fd, const void* data, size_t len){
+  const char* next = (const char*)data;
+  while(len > 0){
+    ssize_t written = write(fd, next, len);
+    if(written <= 0){
+      return false;
+    }
+    next += written;
+    len -= written;
+  }
+  return true;
+}
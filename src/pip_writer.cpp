@@ -0,0 +1,145 @@
+/*
+ * Copyright (C) 2014 Robert S. Moore II and Rutgers University
+ * All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA
+ * or visit http://www.gnu.org/licenses/gpl-2.0.html
+ */
+
+/*******************************************************************************
+ * @file pip_writer.cpp
+ * Files written in the background by a writer thread.
+ *
+ * @author Robert S. Moore II
+ ******************************************************************************/
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <pip_util.hpp>
+#include <pip_writer.hpp>
+
+using std::string;
+using std::vector;
+
+/*
+ * Syncs the directory holding path, so that a file renamed into it stays
+ * renamed after a crash.
+ */
+static bool syncDirectory(const string& path){
+  size_t slash = path.rfind('/');
+  string dir = string::npos == slash ? "." : (0 == slash ? "/" : path.substr(0, slash));
+  int fd = open(dir.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  if(0 > fd){
+    return false;
+  }
+  bool synced = 0 == fsync(fd);
+  close(fd);
+  return synced;
+}
+
+/*
+ * Writes data to path.  The data goes to path.new, which replaces path once
+ * it is complete and on disk.  Returns false if the file could not be
+ * written, leaving path as it was.
+ */
+bool writeFile(const string& path, const vector<unsigned char>& data){
+  string temp = path + ".new";
+  int fd = open(temp.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+  if(0 > fd){
+    return false;
+  }
+  //The data must be on disk before the rename is, or a crash could leave
+  //path naming a file that was never written
+  bool written = writeAll(fd, data.data(), data.size()) and 0 == fsync(fd);
+  written = 0 == close(fd) and written;
+  if(not written or 0 != rename(temp.c_str(), path.c_str())){
+    unlink(temp.c_str());
+    return false;
+  }
+  return syncDirectory(path);
+}
+
+/*
+ * Body of the writer thread.
+ */
+static void writeJobs(file_writer_t* writer){
+  for(size_t i = 0; i < writer->writing.size(); ++i){
+    write_job_t& job = writer->writing[i];
+    job.failed = not writeFile(job.path, job.data);
+  }
+  writer->done = true;
+}
+
+/*
+ * Hands the files queued so far to a new writer thread.
+ */
+static void startWriter(file_writer_t& writer){
+  writer.writing.swap(writer.queued);
+  writer.done = false;
+  writer.thread = std::thread(writeJobs, &writer);
+}
+
+/*
+ * Queues data to be written to path in the background.  The data is taken
+ * from the caller, leaving it empty.
+ */
+void queueWrite(file_writer_t& writer, const string& path, vector<unsigned char>& data){
+  writer.queued.push_back(write_job_t());
+  write_job_t& job = writer.queued.back();
+  job.path = path;
+  job.data.swap(data);
+  job.failed = false;
+  if(not writer.thread.joinable()){
+    startWriter(writer);
+  }
+}
+
+/*
+ * True if a file queued for path is not written yet.
+ */
+bool writePending(const file_writer_t& writer, const string& path){
+  for(size_t i = 0; i < writer.queued.size(); ++i){
+    if(path == writer.queued[i].path){
+      return true;
+    }
+  }
+  for(size_t i = 0; i < writer.writing.size() and writer.thread.joinable(); ++i){
+    if(path == writer.writing[i].path){
+      return true;
+    }
+  }
+  return false;
+}
+
+/*
+ * Collects the files written since the last call, adding those that could
+ * not be written to failed, and starts writing the files queued since.
+ * With wait it returns only once every queued file is written.
+ */
+void finishWrites(file_writer_t& writer, bool wait, vector<string>& failed){
+  while(writer.thread.joinable() and (wait or writer.done)){
+    writer.thread.join();
+    for(size_t i = 0; i < writer.writing.size(); ++i){
+      if(writer.writing[i].failed){
+        failed.push_back(writer.writing[i].path);
+      }
+    }
+    writer.writing.clear();
+    if(not writer.queued.empty()){
+      startWriter(writer);
+    }
+  }
+}